@@ -0,0 +1,68 @@
+// sched_getaffinity()
+#define _GNU_SOURCE
+
+#include "bench.h"
+
+#include <sched.h>
+#include <time.h>
+
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+
+void bench_spin(uint64_t ns)
+{
+    uint64_t end = bench_now_ns() + ns;
+
+    while (bench_now_ns() < end) {}
+}
+
+
+int bench_ncpu(void)
+{
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set)) {
+        return 1;
+    }
+
+    return CPU_COUNT(&set);
+}
+
+
+void bench_hist_print(FILE *out, const hist_t *hist)
+{
+    uint32_t i;
+    int first = 1;
+
+    fprintf(out, "\"count\": %llu, \"min_ns\": %llu, \"mean_ns\": %.1f, "
+                 "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+                 "\"p999_ns\": %llu, \"max_ns\": %llu, \"buckets\": [",
+            (unsigned long long) hist->total,
+            (unsigned long long) (hist->total ? hist->min : 0),
+            hist_mean(hist),
+            (unsigned long long) hist_percentile(hist, 50),
+            (unsigned long long) hist_percentile(hist, 90),
+            (unsigned long long) hist_percentile(hist, 99),
+            (unsigned long long) hist_percentile(hist, 99.9),
+            (unsigned long long) hist->max);
+
+    // [upper bound in ns, count] of the non-empty buckets
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        if (hist->counts[i]) {
+            fprintf(out, "%s[%llu, %llu]", first ? "" : ", ",
+                    (unsigned long long) hist_bucket_upper(i),
+                    (unsigned long long) hist->counts[i]);
+            first = 0;
+        }
+    }
+
+    fprintf(out, "]");
+}
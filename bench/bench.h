@@ -0,0 +1,37 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * Helpers shared by the benchmarks: clock, busy waiting and
+ * histograms printed as JSON.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hist.h"
+
+
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t bench_now_ns(void);
+
+/**
+ * Busy wait for `ns` nanoseconds.
+ */
+void bench_spin(uint64_t ns);
+
+/**
+ * Number of CPUs the process may run on.
+ */
+int bench_ncpu(void);
+
+/**
+ * Print the summary and the non-empty buckets as JSON members,
+ * without the enclosing braces.
+ */
+void bench_hist_print(FILE *out, const hist_t *hist);
+
+
+#endif //BENCH_H
@@ -0,0 +1,122 @@
+/**
+ * Measures the delay between posting a task and a worker starting it.
+ *
+ * Cases, one JSON object per line on stdout with the histogram:
+ *  - paced: one task every `gap_us`, mostly waking up a parked worker
+ *  - burst: all tasks posted at once, mostly waiting in the queue
+ *
+ * Both run with and without spinning before parking, on 1..N workers,
+ * N being the number of CPUs unless given.
+ *
+ * Usage: bench_latency [max_threads] [ntasks] [gap_us]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "bench.h"
+
+
+#define MAX_HISTS 1024
+
+
+// each worker records into its own histogram, merged at the end
+static __thread hist_t *t_hist = NULL;
+static hist_t *g_hists[MAX_HISTS];
+static int g_nhist = 0;
+static pthread_mutex_t g_hists_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void *record(void *args)
+{
+    uint64_t posted = *(uint64_t *) args;
+    uint64_t now = bench_now_ns();
+
+    if (t_hist == NULL) {
+        t_hist = malloc(sizeof(hist_t));
+        hist_init(t_hist);
+
+        pthread_mutex_lock(&g_hists_lock);
+        g_hists[g_nhist++] = t_hist;
+        pthread_mutex_unlock(&g_hists_lock);
+    }
+
+    hist_record(t_hist, now - posted);
+
+    return NULL;
+}
+
+
+static void run(const char *name, int threads, uint32_t spin_us, int ntasks, useconds_t gap_us)
+{
+    int i;
+    uint64_t now;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    hist_t hist;
+
+    tp_attr_init(&attr);
+    attr.spin_us = spin_us;
+    attr.overflow = TP_OVERFLOW_BLOCK;
+
+    if (!tp_init_attr(&tp, (uint32_t) threads, &attr) || !tp_start(&tp)) {
+        fprintf(stderr, "failed to start the pool\n");
+        exit(1);
+    }
+
+    for (i = 0; i < ntasks; ++i) {
+        now = bench_now_ns();
+        tp_post_task(&tp, tp_task_create_pooled(&tp, record, NULL, &now, sizeof(now)));
+
+        if (gap_us) {
+            usleep(gap_us);
+        }
+    }
+
+    tp_join_tasks(&tp);
+
+    // the workers exit before their histograms are read
+    tp_destroy(&tp);
+
+    hist_init(&hist);
+
+    for (i = 0; i < g_nhist; ++i) {
+        hist_merge(&hist, g_hists[i]);
+        free(g_hists[i]);
+    }
+
+    g_nhist = 0;
+
+    printf("{\"bench\": \"latency\", \"case\": \"%s\", \"threads\": %d, \"spin_us\": %u, "
+           "\"gap_us\": %u, ", name, threads, spin_us, (unsigned) gap_us);
+    bench_hist_print(stdout, &hist);
+    printf("}\n");
+    fflush(stdout);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int threads;
+    int max_threads = argc > 1 ? atoi(argv[1]) : bench_ncpu();
+    int ntasks = argc > 2 ? atoi(argv[2]) : 20000;
+    useconds_t gap_us = argc > 3 ? (useconds_t) atoi(argv[3]) : 50;
+    const uint32_t spins[] = {0, 50};
+    int k;
+
+    if (max_threads > MAX_HISTS) {
+        max_threads = MAX_HISTS;
+    }
+
+    for (k = 0; k < 2; ++k) {
+        for (threads = 1; threads <= max_threads; threads *= 2) {
+            run("paced", threads, spins[k], ntasks, gap_us);
+            run("burst", threads, spins[k], ntasks, 0);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+/**
+ * Measures how many tasks per second go through the pool.
+ *
+ * Cases, one JSON object per line on stdout:
+ *  - empty:    empty tasks, every queue kind, 1..N workers and 1..N producers
+ *  - batch:    empty tasks posted with tp_post_tasks() in batches
+ *  - duration: tasks spinning for a while, 1..N workers
+ *
+ * N is the number of CPUs unless given. Producers post pooled tasks
+ * and wait for room when the queues are full.
+ *
+ * Usage: bench_throughput [max_threads] [ntasks]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+#include "bench.h"
+
+
+#define MAX_BATCH 256
+// busy time of the workers in the duration case, bounding its tasks
+#define DURATION_BUDGET_NS (200ull * 1000 * 1000)
+
+
+typedef struct config_s
+{
+    const char *name;
+    tp_queue_kind_t kind;
+    int threads;
+    int producers;
+    int batch;
+    uint64_t task_ns;
+    int ntasks;
+} config_t;
+
+
+typedef struct producer_s
+{
+    thread_pool_t *tp;
+    const config_t *config;
+    int ntasks;
+    volatile int *go;
+    pthread_t thread;
+} producer_t;
+
+
+static const char *kind_name(tp_queue_kind_t kind)
+{
+    switch (kind) {
+        case TP_QUEUE_RING:
+            return "ring";
+        case TP_QUEUE_INTRUSIVE:
+            return "intrusive";
+        default:
+            return "list";
+    }
+}
+
+
+/**
+ * 1, 2, 4 ... and `max` itself.
+ */
+static int next_count(int n, int max)
+{
+    return n * 2 <= max || n == max ? n * 2 : max;
+}
+
+
+void *empty(void *args)
+{
+    UNUSED_PARAM(args);
+
+    return NULL;
+}
+
+
+void *spin(void *args)
+{
+    bench_spin(*(uint64_t *) args);
+
+    return NULL;
+}
+
+
+static tp_task_t *create_task(thread_pool_t *tp, const config_t *config)
+{
+    if (config->task_ns) {
+        return tp_task_create_pooled(tp, spin, NULL, (void *) &config->task_ns, sizeof(uint64_t));
+    }
+
+    return tp_task_create_pooled(tp, empty, NULL, NULL, 0);
+}
+
+
+void *produce(void *args)
+{
+    int i;
+    int n;
+    int posted;
+    producer_t *producer = args;
+    const config_t *config = producer->config;
+    tp_task_t *tasks[MAX_BATCH];
+
+    while (!__atomic_load_n(producer->go, __ATOMIC_ACQUIRE)) {}
+
+    for (i = 0; i < producer->ntasks; i += n) {
+        n = producer->ntasks - i < config->batch ? producer->ntasks - i : config->batch;
+
+        if (n == 1) {
+            tp_post_task(producer->tp, create_task(producer->tp, config));
+            continue;
+        }
+
+        for (posted = 0; posted < n; ++posted) {
+            tasks[posted] = create_task(producer->tp, config);
+        }
+
+        tp_post_tasks(producer->tp, tasks, n);
+    }
+
+    return NULL;
+}
+
+
+static void run(const config_t *config)
+{
+    int i;
+    int go = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    producer_t *producers;
+
+    tp_attr_init(&attr);
+    attr.queue_kind = config->kind;
+    attr.overflow = TP_OVERFLOW_BLOCK;
+
+    if (!tp_init_attr(&tp, (uint32_t) config->threads, &attr) || !tp_start(&tp)) {
+        fprintf(stderr, "failed to start the pool\n");
+        exit(1);
+    }
+
+    producers = calloc((size_t) config->producers, sizeof(producer_t));
+
+    for (i = 0; i < config->producers; ++i) {
+        producers[i].tp = &tp;
+        producers[i].config = config;
+        producers[i].ntasks = config->ntasks / config->producers;
+        producers[i].go = &go;
+
+        if (pthread_create(&producers[i].thread, NULL, produce, &producers[i])) {
+            perror("pthread_create() failed");
+            exit(1);
+        }
+    }
+
+    start = bench_now_ns();
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < config->producers; ++i) {
+        pthread_join(producers[i].thread, NULL);
+    }
+
+    tp_join_tasks(&tp);
+    elapsed = bench_now_ns() - start;
+
+    printf("{\"bench\": \"throughput\", \"case\": \"%s\", \"queue\": \"%s\", "
+           "\"threads\": %d, \"producers\": %d, \"batch\": %d, \"task_ns\": %llu, "
+           "\"tasks\": %d, \"elapsed_ns\": %llu, \"tasks_per_sec\": %.0f}\n",
+           config->name, kind_name(config->kind), config->threads, config->producers,
+           config->batch, (unsigned long long) config->task_ns,
+           config->ntasks / config->producers * config->producers,
+           (unsigned long long) elapsed,
+           (double) (config->ntasks / config->producers * config->producers) * 1e9 / (double) elapsed);
+    fflush(stdout);
+
+    free(producers);
+    tp_destroy(&tp);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int k;
+    int i;
+    int max_threads = argc > 1 ? atoi(argv[1]) : bench_ncpu();
+    int ntasks = argc > 2 ? atoi(argv[2]) : 200000;
+    const tp_queue_kind_t kinds[] = {TP_QUEUE_LIST, TP_QUEUE_RING, TP_QUEUE_INTRUSIVE};
+    const int batches[] = {1, 16, MAX_BATCH};
+    const uint64_t durations[] = {1000, 10000, 100000};
+    uint64_t budget;
+    config_t config;
+
+    for (k = 0; k < 3; ++k) {
+        for (config.threads = 1; config.threads <= max_threads;
+             config.threads = next_count(config.threads, max_threads)) {
+            for (config.producers = 1; config.producers <= max_threads;
+                 config.producers = next_count(config.producers, max_threads)) {
+                config.name = "empty";
+                config.kind = kinds[k];
+                config.batch = 1;
+                config.task_ns = 0;
+                config.ntasks = ntasks;
+                run(&config);
+            }
+        }
+    }
+
+    for (k = 0; k < 3; ++k) {
+        for (i = 0; i < 3; ++i) {
+            config.name = "batch";
+            config.kind = kinds[k];
+            config.threads = max_threads;
+            config.producers = 1;
+            config.batch = batches[i];
+            config.task_ns = 0;
+            config.ntasks = ntasks;
+            run(&config);
+        }
+    }
+
+    for (i = 0; i < 3; ++i) {
+        for (config.threads = 1; config.threads <= max_threads;
+             config.threads = next_count(config.threads, max_threads)) {
+            budget = DURATION_BUDGET_NS * (uint64_t) config.threads / durations[i];
+
+            config.name = "duration";
+            config.kind = TP_QUEUE_LIST;
+            config.producers = 1;
+            config.batch = 1;
+            config.task_ns = durations[i];
+            config.ntasks = budget < (uint64_t) ntasks ? (int) budget : ntasks;
+            run(&config);
+        }
+    }
+
+    return 0;
+}
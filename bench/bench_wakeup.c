@@ -0,0 +1,61 @@
+/**
+ * Measures how many wakeups the producers issue.
+ *
+ * A post only wakes a worker when one is parked, so with busy workers
+ * most posts should skip the wakeup entirely.
+ *
+ * Usage: bench_wakeup [nthreads] [ntasks] [spin_ns]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+#include "bench.h"
+
+
+void *spin(void *args)
+{
+    bench_spin(*(uint64_t *) args);
+
+    return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i;
+    int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    int ntasks = argc > 2 ? atoi(argv[2]) : 200000;
+    uint64_t spin_ns = argc > 3 ? strtoull(argv[3], NULL, 10) : 1000;
+    uint64_t start;
+    uint64_t elapsed;
+    thread_pool_t tp;
+
+    if (!tp_init(&tp, nthreads) || !tp_start(&tp)) {
+        fprintf(stderr, "failed to start the pool\n");
+        return 1;
+    }
+
+    start = bench_now_ns();
+
+    for (i = 0; i < ntasks; ++i) {
+        tp_post_task(&tp, tp_task_create(spin, NULL, &spin_ns, sizeof(spin_ns)));
+    }
+
+    tp_join_tasks(&tp);
+    elapsed = bench_now_ns() - start;
+
+    printf("{\"bench\": \"wakeup\", \"threads\": %d, \"tasks\": %d, \"task_ns\": %llu, "
+           "\"elapsed_ns\": %llu, \"wake_calls\": %llu, \"wake_skipped\": %llu, "
+           "\"wakes_per_post\": %.4f}\n",
+           nthreads, ntasks, (unsigned long long) spin_ns,
+           (unsigned long long) elapsed,
+           (unsigned long long) tp.wake_calls,
+           (unsigned long long) tp.wake_skipped,
+           (double) tp.wake_calls / ntasks);
+
+    tp_destroy(&tp);
+
+    return 0;
+}
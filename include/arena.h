@@ -0,0 +1,80 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/**
+ * Bump allocator for short-lived memory.
+ *
+ * Allocating moves a cursor forward in the current chunk, taking a new
+ * chunk when it's full. Nothing is freed one by one, arena_reset()
+ * rewinds the arena and keeps its chunks for the next round, so once
+ * it has grown to the usual need it doesn't call malloc() anymore.
+ * Requests larger than a chunk get their own chunk, freed on reset.
+ * Not thread safe.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+// alignment of every allocation
+#define ARENA_ALIGN 16
+
+
+typedef struct arena_s arena_t;
+typedef struct arena_chunk_s arena_chunk_t;
+
+
+struct arena_chunk_s
+{
+    arena_chunk_t *next;
+    // bytes of data following the header, and the ones handed out
+    size_t size;
+    size_t used;
+};
+
+struct arena_s
+{
+    // regular chunks, kept by arena_reset()
+    arena_chunk_t *chunks;
+    // chunk allocations are taken from, NULL before the first one
+    arena_chunk_t *current;
+    // chunks of the requests larger than `chunk_size`
+    arena_chunk_t *large;
+    size_t chunk_size;
+    // bytes handed out since the last reset
+    size_t used;
+};
+
+
+/* ---------------- Arena API ---------------- */
+
+/**
+ * Initialize an empty arena, no memory is allocated until the first
+ * arena_alloc().
+ *
+ * @param chunk_size size of each chunk
+ * @return true: succeed
+ *         false: failed
+ */
+bool arena_init(arena_t *arena, size_t chunk_size);
+
+/**
+ * Free every chunk of the arena.
+ */
+void arena_destroy(arena_t *arena);
+
+/**
+ * Allocate `size` bytes aligned on ARENA_ALIGN, valid until the next
+ * arena_reset() or arena_destroy().
+ *
+ * @return the memory, or NULL if malloc() failed
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * Release every allocation at once, keeping the regular chunks.
+ */
+void arena_reset(arena_t *arena);
+
+
+#endif //ARENA_H
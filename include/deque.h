@@ -0,0 +1,93 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+/**
+ * Fixed-capacity Chase-Lev work-stealing deque.
+ *
+ * The owner thread pushes and pops at the bottom, any other thread
+ * may steal from the top. Only the owner may call deque_push() and
+ * deque_pop(), deque_steal() is safe from any thread.
+ *
+ * See "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <queue.h>
+
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+
+typedef struct deque_s deque_t;
+
+
+struct deque_s
+{
+    int64_t top;
+    char pad0[CACHE_LINE_SIZE - sizeof(int64_t)];
+
+    int64_t bottom;
+    char pad1[CACHE_LINE_SIZE - sizeof(int64_t)];
+
+    qdata_t *buffer;
+    uint32_t mask;
+};
+
+
+/* ---------------- Deque API ---------------- */
+
+/**
+ * Initialize a deque.
+ *
+ * @param deque deque to be initialized
+ * @param capacity maximum number of elements, rounded up to a power of 2
+ * @return true: succeed
+ *         false: failed
+ */
+bool deque_init(deque_t *deque, uint32_t capacity);
+
+/**
+ * Destroy a deque, the elements remaining are dropped.
+ *
+ * @param deque deque to be destroyed
+ */
+void deque_destroy(deque_t *deque);
+
+/**
+ * Push an element at the bottom. Owner only.
+ *
+ * @return true: succeed
+ *         false: the deque is full
+ */
+bool deque_push(deque_t *deque, qdata_t data);
+
+/**
+ * Pop an element from the bottom. Owner only.
+ *
+ * @return true: succeed
+ *         false: the deque is empty
+ */
+bool deque_pop(deque_t *deque, qdata_t *data);
+
+/**
+ * Steal an element from the top. Any thread.
+ *
+ * @return true: succeed
+ *         false: the deque is empty or another thief won the race
+ */
+bool deque_steal(deque_t *deque, qdata_t *data);
+
+/**
+ * Approximate number of elements in the deque.
+ */
+uint32_t deque_len(deque_t *deque);
+
+#define deque_isempty(deque) (deque_len(deque) == 0)
+
+
+#endif //DEQUE_H
@@ -0,0 +1,87 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+/**
+ * Growable 4-ary min-heap keyed by 64-bit integers.
+ *
+ * A node's children are stored at 4i+1 .. 4i+4, which halves the
+ * depth of a binary heap. The four children are adjacent, 64 bytes of
+ * 16-byte nodes, so comparing them touches at most two cache lines.
+ * Not thread safe.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <queue.h>
+
+
+typedef struct heap_s heap_t;
+typedef struct heap_node_s heap_node_t;
+
+
+struct heap_node_s
+{
+    uint64_t key;
+    qdata_t data;
+};
+
+struct heap_s
+{
+    heap_node_t *nodes;
+    uint32_t len;
+    uint32_t capacity;
+};
+
+
+/* ---------------- Heap API ---------------- */
+
+/**
+ * Initialize a heap.
+ *
+ * @param heap heap to be initialized
+ * @param capacity number of nodes to allocate, 0 to allocate
+ *        on the first push. The heap grows when it's full.
+ * @return true: succeed
+ *         false: failed
+ */
+bool heap_init(heap_t *heap, uint32_t capacity);
+
+/**
+ * Destroy a heap, the nodes remaining are dropped.
+ *
+ * @param heap heap to be destroyed
+ */
+void heap_destroy(heap_t *heap);
+
+/**
+ * Insert a node.
+ *
+ * @return true: succeed
+ *         false: failed to grow the heap
+ */
+bool heap_push(heap_t *heap, uint64_t key, qdata_t data);
+
+/**
+ * Get the node with the smallest key without removing it.
+ *
+ * @return true: succeed
+ *         false: the heap is empty
+ */
+bool heap_top(heap_t *heap, heap_node_t *node);
+
+/**
+ * Remove the node with the smallest key.
+ *
+ * @param node receives the node removed, may be NULL
+ * @return true: succeed
+ *         false: the heap is empty
+ */
+bool heap_pop(heap_t *heap, heap_node_t *node);
+
+#define heap_len(heap) ((heap)->len)
+
+#define heap_isempty(heap) ((heap)->len == 0)
+
+
+#endif //HEAP_H
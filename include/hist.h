@@ -0,0 +1,76 @@
+#ifndef HIST_H
+#define HIST_H
+
+/**
+ * Log-linear histogram of 64-bit values, in the spirit of HDR histograms.
+ *
+ * Values below 2 * HIST_SUB have their own bucket, each larger power
+ * of two is split into HIST_SUB buckets, so a bucket is never wider
+ * than 1/HIST_SUB of its values. Recording is a few instructions and
+ * allocates nothing. Not thread safe, give each writer its own and
+ * merge them to read.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// sub-buckets of each power of two
+#define HIST_SUB 8
+#define HIST_BUCKETS (2 * HIST_SUB + 60 * HIST_SUB)
+
+
+typedef struct hist_s hist_t;
+
+
+struct hist_s
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    // UINT64_MAX while it's empty
+    uint64_t min;
+    uint64_t max;
+};
+
+
+/* ---------------- Histogram API ---------------- */
+
+/**
+ * Initialize an empty histogram.
+ */
+void hist_init(hist_t *hist);
+
+/**
+ * Count a value.
+ */
+void hist_record(hist_t *hist, uint64_t value);
+
+/**
+ * Add the counts of `src` to `dst`.
+ */
+void hist_merge(hist_t *dst, const hist_t *src);
+
+/**
+ * Get the value below which `p` percent of the values are,
+ * rounded up to the bucket's upper bound, 0 if it's empty.
+ *
+ * @param p 0 to 100
+ */
+uint64_t hist_percentile(const hist_t *hist, double p);
+
+/**
+ * Bucket a value is counted in.
+ */
+uint32_t hist_bucket(uint64_t value);
+
+/**
+ * Largest value counted in a bucket.
+ */
+uint64_t hist_bucket_upper(uint32_t bucket);
+
+#define hist_mean(hist) \
+((hist)->total ? (double) (hist)->sum / (double) (hist)->total : 0.0)
+
+
+#endif //HIST_H
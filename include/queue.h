@@ -52,6 +52,12 @@ bool queue_dequeue(queue_t *queue, qdata_t *data);
 
 uint32_t queue_len(queue_t *queue);
 
+/**
+ * Move all nodes of `other` to the end of `queue` in O(1),
+ * leaving `other` empty.
+ */
+bool queue_append(queue_t *queue, queue_t *other);
+
 #define queue_isempty(queue) (queue_len(queue) == 0)
 
 /* ---------------- qnode_t API ---------------- */
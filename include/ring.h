@@ -0,0 +1,103 @@
+#ifndef RING_H
+#define RING_H
+
+/**
+ * Bounded lock-free multi-producer/multi-consumer ring buffer.
+ *
+ * Every slot carries a sequence number telling whether it's ready to
+ * be written or read in the current lap, so both enqueue and dequeue
+ * cost one CAS on the shared cursor plus one store on the slot.
+ * No memory is allocated after ring_init().
+ *
+ * See Dmitry Vyukov's "Bounded MPMC queue".
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <queue.h>
+
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+
+typedef struct ring_s ring_t;
+typedef struct ring_cell_s ring_cell_t;
+
+
+struct ring_cell_s
+{
+    uint64_t seq;
+    qdata_t data;
+};
+
+struct ring_s
+{
+    uint64_t head;
+    char pad0[CACHE_LINE_SIZE - sizeof(uint64_t)];
+
+    uint64_t tail;
+    char pad1[CACHE_LINE_SIZE - sizeof(uint64_t)];
+
+    ring_cell_t *cells;
+    uint32_t mask;
+};
+
+
+/* ---------------- Ring API ---------------- */
+
+/**
+ * Initialize a ring.
+ *
+ * @param ring ring to be initialized
+ * @param capacity maximum number of elements, rounded up to a power of 2
+ * @return true: succeed
+ *         false: failed
+ */
+bool ring_init(ring_t *ring, uint32_t capacity);
+
+/**
+ * Destroy a ring, the elements remaining are dropped.
+ *
+ * @param ring ring to be destroyed
+ */
+void ring_destroy(ring_t *ring);
+
+/**
+ * Enqueue an element, safe from any thread.
+ *
+ * @return true: succeed
+ *         false: the ring is full
+ */
+bool ring_enqueue(ring_t *ring, qdata_t data);
+
+/**
+ * Enqueue as many elements of `data` as there is room for, claiming
+ * their slots with a single CAS. Safe from any thread.
+ *
+ * @return number of elements enqueued, which are always
+ *         the first ones of `data`
+ */
+uint32_t ring_enqueue_bulk(ring_t *ring, const qdata_t *data, uint32_t n);
+
+/**
+ * Dequeue an element, safe from any thread.
+ *
+ * @return true: succeed
+ *         false: the ring is empty
+ */
+bool ring_dequeue(ring_t *ring, qdata_t *data);
+
+/**
+ * Approximate number of elements in the ring.
+ */
+uint32_t ring_len(ring_t *ring);
+
+#define ring_isempty(ring) (ring_len(ring) == 0)
+
+#define ring_capacity(ring) ((ring)->mask + 1)
+
+
+#endif //RING_H
@@ -9,19 +9,157 @@
  */
 
 #include <pthread.h>
+#include <stdio.h>
 
 #include <queue.h>
+#include <deque.h>
+#include <ring.h>
+#include <heap.h>
+#include <hist.h>
+#include <arena.h>
 
 #define UNUSED_PARAM(x) (void)(x)
 
+/**
+ * Arguments not larger than this are copied into the task itself
+ * instead of a malloc'ed area. Define it before including this header
+ * (for both the library and its users) to change it.
+ */
+#ifndef TP_TASK_INLINE_ARGS
+#define TP_TASK_INLINE_ARGS 64
+#endif
+
+/**
+ * Priorities of the default three classes, a smaller value is
+ * served first. Pools with `npriority` classes accept 0 to
+ * npriority - 1, larger ones are treated as the lowest.
+ */
+#define TP_PRIORITY_HIGH 0
+#define TP_PRIORITY_NORMAL 1
+#define TP_PRIORITY_LOW 2
+
+/**
+ * Node hint of a task which may run on any node.
+ */
+#define TP_NODE_ANY UINT32_MAX
+
+/**
+ * Timeout of the calls which may wait as long as it takes.
+ */
+#define TP_TIMEOUT_INFINITE UINT64_MAX
+
+/**
+ * Counter stripes shared by the threads which aren't workers of a pool.
+ */
+#ifndef TP_METRICS_STRIPES
+#define TP_METRICS_STRIPES 8
+#endif
+
 
 typedef void *(*runnable_t)(void *args);
 
 typedef void (*cleanup_t)(void *args);
 
+// Called on a subrange [begin, end) by tp_parallel_for()
+typedef void (*tp_range_fn_t)(void *ctx, uint64_t begin, uint64_t end);
+
+// Accumulate [begin, end) into `acc` for tp_parallel_reduce()
+typedef void (*tp_reduce_fn_t)(void *ctx, uint64_t begin, uint64_t end, void *acc);
+
+// Combine the accumulator `other` into `acc`
+typedef void (*tp_combine_fn_t)(void *ctx, void *acc, const void *other);
+
 typedef struct tp_task_s tp_task_t;
 typedef struct thread_pool_s thread_pool_t;
 typedef struct thread_local_s thread_local_t;
+typedef struct tp_attr_s tp_attr_t;
+typedef struct tp_worker_s tp_worker_t;
+typedef struct tp_task_list_s tp_task_list_t;
+typedef struct tp_task_stats_s tp_task_stats_t;
+typedef struct tp_slab_s tp_slab_t;
+typedef struct tp_future_s tp_future_t;
+typedef struct tp_group_s tp_group_t;
+typedef struct tp_lane_s tp_lane_t;
+typedef struct tp_priority_stats_s tp_priority_stats_t;
+typedef struct tp_topo_s tp_topo_t;
+typedef struct tp_overflow_stats_s tp_overflow_stats_t;
+typedef struct tp_worker_metrics_s tp_worker_metrics_t;
+typedef struct tp_metrics_stripe_s tp_metrics_stripe_t;
+typedef struct tp_metrics_s tp_metrics_t;
+typedef struct tp_trace_buf_s tp_trace_buf_t;
+
+
+typedef enum
+{
+    // All workers share one FIFO queue guarded by `lock`
+    TP_SCHED_SHARED = 0,
+    // Each worker owns a deque, tasks posted from a worker go to its own
+    // deque and idle workers steal from the others
+    TP_SCHED_STEALING
+} tp_sched_t;
+
+
+typedef enum
+{
+    // Unbounded linked list `task_queue` guarded by `lock`
+    TP_QUEUE_LIST = 0,
+    // Bounded lock-free ring `task_ring`, posting fails when it's full
+    TP_QUEUE_RING,
+    // Unbounded list `task_list` linking tasks through `tp_task_s.next`,
+    // guarded by `lock`, no allocation on posting
+    TP_QUEUE_INTRUSIVE
+} tp_queue_kind_t;
+
+
+typedef enum
+{
+    // Workers run wherever the OS puts them
+    TP_AFFINITY_NONE = 0,
+    // Each worker is pinned to one CPU, taken round robin from
+    // `cpus`, or from the CPUs the process may run on
+    TP_AFFINITY_CPU,
+    // Each worker is bound to all CPUs of one NUMA node,
+    // the workers are spread over the nodes round robin
+    TP_AFFINITY_NODE
+} tp_affinity_t;
+
+
+typedef enum
+{
+    // Run every queued task before the workers exit
+    TP_DRAIN_QUEUED = 0,
+    // Finish the running tasks, free the queued ones without running them
+    TP_DRAIN_RUNNING,
+    // Like TP_DRAIN_RUNNING, calling the `cleanup` of the queued ones
+    TP_DRAIN_DISCARD
+} tp_drain_t;
+
+
+typedef enum
+{
+    // a task was posted, by the thread posting it
+    TP_TRACE_POST = 0,
+    // a task started and ended, by the thread running it
+    TP_TRACE_START,
+    TP_TRACE_END,
+    // a worker parked and woke up
+    TP_TRACE_PARK,
+    TP_TRACE_WAKE
+} tp_trace_kind_t;
+
+
+typedef enum
+{
+    // Posting fails at once, the task still belongs to the caller
+    TP_OVERFLOW_FAIL = 0,
+    // The producer waits for room, at most `overflow_timeout_us`
+    TP_OVERFLOW_BLOCK,
+    // The producer runs the task itself
+    TP_OVERFLOW_CALLER_RUNS,
+    // The oldest queued task of the lowest class is discarded
+    // (its `cleanup` is called) to make room
+    TP_OVERFLOW_DROP_OLDEST
+} tp_overflow_t;
 
 
 struct tp_task_s
@@ -30,19 +168,405 @@ struct tp_task_s
     cleanup_t cleanup;
     void *args;
     size_t args_len;
+
+    // link of intrusive lists, owned by the pool once posted
+    tp_task_t *next;
+    // pool whose slab the task was allocated from, NULL if malloc'ed
+    thread_pool_t *owner;
+    // receives the value returned by `runner`
+    tp_future_t *future;
+    // group counting the task down when it's finished
+    tp_group_t *group;
+    // scheduling class, TP_PRIORITY_NORMAL by default
+    uint32_t priority;
+    // when a delayed or periodic task is due, CLOCK_MONOTONIC in ns
+    uint64_t due_ns;
+    // period of a periodic task, 0 for the others
+    uint64_t interval_ns;
+    // set by tp_cancel_periodic()
+    uint32_t cancelled;
+    // when it was queued, CLOCK_MONOTONIC in ns, only in elastic mode
+    // or with `attr.metrics`
+    uint64_t post_ns;
+    // node of the pool the task is queued to, TP_NODE_ANY for the
+    // poster's own node, see tp_post_task_node()
+    uint32_t node;
+    // node whose free list a pooled task goes back to, kept by
+    // tp_task_init() and restored by tp_task_free()
+    uint32_t slab_node;
+
+    // unfinished predecessors plus one, see tp_task_then()
+    uint32_t deps;
+    // set when a predecessor was destroyed without running
+    uint32_t dep_cancelled;
+    // pool it's posted to while waiting for its predecessors
+    thread_pool_t *dep_pool;
+    // tasks waiting for this one
+    tp_task_t **succ;
+    uint32_t nsucc;
+
+    // pool and runner the task moves on to when `runner` returns,
+    // see tp_task_handoff()
+    thread_pool_t *handoff;
+    runnable_t handoff_runner;
+
+    // storage of small args, `args` points here when it's used,
+    // so an initialized task must not be copied by value
+    union
+    {
+        char buf[TP_TASK_INLINE_ARGS];
+        void *align_ptr;
+        uint64_t align_u64;
+        long double align_ld;
+    } inline_args;
+};
+
+
+struct tp_task_list_s
+{
+    tp_task_t *head;
+    tp_task_t *tail;
+    uint32_t len;
+};
+
+
+typedef enum
+{
+    TP_FUTURE_PENDING = 0,
+    // pending, and some threads are blocked on it
+    TP_FUTURE_WAITING,
+    TP_FUTURE_READY,
+    // the task was destroyed without being run
+    TP_FUTURE_CANCELLED
+} tp_future_state_t;
+
+
+struct tp_future_s
+{
+    // tp_future_state_t, also the futex word waiters block on
+    uint32_t state;
+    uint32_t refs;
+    void *result;
+};
+
+
+// set in `tp_group_s.pending` while somebody may be blocked on it
+#define TP_GROUP_WAITING 0x80000000u
+
+
+struct tp_group_s
+{
+    // number of unfinished tasks with TP_GROUP_WAITING, in one word so
+    // the last tp_group_done() learns about waiters from its own
+    // decrement and never touches the group after releasing them.
+    // Also the futex word waiters block on.
+    uint32_t pending;
+};
+
+
+struct tp_task_stats_s
+{
+    // allocations served by a worker's private cache
+    uint64_t local_hits;
+    // allocations served by the pool's shared free list
+    uint64_t shared_hits;
+    // allocations that had to create a new slab
+    uint64_t misses;
+    // tasks returned to a worker's private cache
+    uint64_t local_frees;
+    // tasks returned to the shared free list by other threads
+    uint64_t remote_frees;
+    // slabs allocated
+    uint64_t slabs;
+};
+
+
+struct tp_overflow_stats_s
+{
+    // posts which had to wait for room
+    uint64_t blocked;
+    // posts which waited for room in vain
+    uint64_t timed_out;
+    // posts which failed, including the timed out ones
+    uint64_t rejected;
+    // tasks run by their producer
+    uint64_t caller_runs;
+    // queued tasks discarded to make room
+    uint64_t dropped;
+};
+
+
+/**
+ * Counters and histograms of one worker, only written by the worker.
+ */
+struct tp_worker_metrics_s
+{
+    // tasks posted from the worker
+    uint64_t posted;
+    // tasks run to the end
+    uint64_t completed;
+    // tasks taken from the deques of other workers
+    uint64_t stolen;
+    // posts refused by the overflow policy
+    uint64_t rejected;
+    // nanoseconds from posting to starting and from starting to the end,
+    // only recorded with `attr.metrics`
+    hist_t wait_ns;
+    hist_t run_ns;
+};
+
+
+/**
+ * Counters of the threads which aren't workers, one cache line each.
+ */
+struct tp_metrics_stripe_s
+{
+    uint64_t posted;
+    uint64_t completed;
+    uint64_t stolen;
+    uint64_t rejected;
+    char pad[CACHE_LINE_SIZE - 4 * sizeof(uint64_t)];
+};
+
+
+/**
+ * Snapshot of the whole pool, see tp_metrics_snapshot().
+ */
+struct tp_metrics_s
+{
+    uint64_t posted;
+    uint64_t completed;
+    uint64_t stolen;
+    uint64_t rejected;
+    // tasks posted and not finished yet
+    uint32_t active_tasks;
+    // tasks waiting in the shared queues, and the deepest a lane has been
+    uint32_t queue_depth;
+    uint32_t queue_high_water;
+    uint32_t live_threads;
+    // merged over the workers
+    hist_t wait_ns;
+    hist_t run_ns;
+};
+
+
+/**
+ * Shared queue of one priority class.
+ */
+struct tp_lane_s
+{
+    // only the one matching `attr.queue_kind` is used
+    queue_t queue;
+    ring_t ring;
+    tp_task_list_t list;
+    // deepest the lane has been
+    uint32_t high_water;
+    // tasks taken ahead of higher classes by aging
+    uint64_t aged;
+};
+
+
+struct tp_priority_stats_s
+{
+    // tasks waiting in the shared queue of the class
+    uint32_t depth;
+    // deepest the queue has been
+    uint32_t high_water;
+    // tasks taken ahead of higher classes to avoid starvation
+    uint64_t aged;
+};
+
+
+struct tp_attr_s
+{
+    tp_sched_t sched;
+    // capacity of each worker's deque in TP_SCHED_STEALING mode,
+    // tasks overflow to the shared queue when it's full
+    uint32_t deque_capacity;
+    tp_queue_kind_t queue_kind;
+    // capacity of the shared queue in TP_QUEUE_RING mode
+    uint32_t queue_capacity;
+    // how long an idle worker polls for tasks before parking, 0 to park at once
+    uint32_t spin_us;
+    // learn from the recent idle gaps how long it's worth spinning
+    bool spin_adaptive;
+    // number of priority classes, each one has its own shared queue
+    uint32_t npriority;
+    // after taking this many tasks in a row while a lower class was
+    // waiting, a worker serves the lowest waiting class once, 0 to disable
+    uint32_t priority_aging;
+    tp_affinity_t affinity;
+    // CPUs of TP_AFFINITY_CPU mode, NULL for all the allowed ones,
+    // the array must outlive tp_start()
+    const int *cpus;
+    uint32_t ncpus;
+    // give each NUMA node its own shared queues and task free list,
+    // workers serve their node first. Implies TP_AFFINITY_NODE unless
+    // TP_AFFINITY_CPU is set.
+    bool numa;
+    // elastic mode when it's larger than the number of threads given to
+    // tp_init_attr(), which is the minimum then. Workers are added when
+    // tasks wait longer than `spawn_latency_us` and nobody is idle,
+    // and the ones above the minimum retire after idling `keep_alive_ms`.
+    uint32_t max_threads;
+    uint32_t spawn_latency_us;
+    // 0 to keep idle workers forever
+    uint32_t keep_alive_ms;
+    // most tasks waiting in the shared queues, 0 for no limit other
+    // than the ring's. `overflow` tells what to do when they're full,
+    // workers of the pool run the task themselves instead of blocking.
+    uint32_t max_queued;
+    tp_overflow_t overflow;
+    // TP_TIMEOUT_INFINITE to wait as long as it takes
+    uint64_t overflow_timeout_us;
+    // record the wait and run time of every task into the workers'
+    // histograms, costing two clock reads per task. Counters are always on.
+    bool metrics;
+    // events kept by each thread while tracing, the oldest are overwritten
+    uint32_t trace_events;
+    // a task a worker posts to the normal class of its node goes to its
+    // slot if it's empty, and runs next on the same worker unless an idle
+    // one steals it first. Off by default, it changes the order tasks run
+    // in. With TP_SCHED_SHARED there's no worker-local queue behind the
+    // slot: while it's taken, further posts go to the shared queues.
+    bool lifo_slot;
+    // chunk size of each worker's scratch arena, see tp_arena_alloc()
+    size_t arena_size;
+    // keep the arena's allocations after each task until tp_arena_reset()
+    bool arena_keep;
+};
+
+
+typedef enum
+{
+    TP_WORKER_RUNNING = 0,
+    TP_WORKER_PARKED
+} tp_park_state_t;
+
+
+typedef enum
+{
+    // no thread was started in the slot
+    TP_SLOT_FREE = 0,
+    TP_SLOT_LIVE,
+    // the thread retired, it's joined when the slot is reused
+    TP_SLOT_EXITED
+} tp_slot_state_t;
+
+
+struct tp_worker_s
+{
+    thread_pool_t *pool;
+    uint32_t index;
+    // tp_slot_state_t, changed under `resize_lock`
+    uint32_t slot;
+    // tp_park_state_t, also the futex word the worker sleeps on
+    uint32_t park;
+    // whether it's in the pool's idle stack, guarded by `idle_lock`
+    bool in_idle;
+    // moving average of how long the worker waited for a task,
+    // only maintained when spinning is enabled
+    uint64_t idle_ewma_ns;
+    uint32_t seed;
+    // node of the pool the worker belongs to, 0 if it's not NUMA aware
+    uint32_t node;
+    deque_t deque;
+    // tasks taken in a row while a lower class was waiting
+    uint32_t prio_streak;
+    // task posted by the worker to be run next, taken with atomic exchanges
+    // by the worker and by thieves
+    tp_task_t *lifo;
+    // tasks taken from `lifo` in a row
+    uint32_t lifo_streak;
+
+    // private cache of free pooled tasks, only touched by the worker
+    tp_task_t *task_cache;
+    uint32_t ntask_cache;
+    uint64_t task_cache_hits;
+    uint64_t task_cache_frees;
+
+    tp_worker_metrics_t metrics;
+    // scratch memory of the tasks it runs, reset after each one
+    arena_t arena;
+    // events of the worker, created when it first records one
+    tp_trace_buf_t *trace;
 };
 
 
 struct thread_pool_s
 {
+    // number of worker slots, the most threads the pool can have
     uint32_t nthread;
     pthread_t *threads;
-    queue_t task_queue;
+    tp_worker_t *workers;
+    tp_attr_t attr;
+    // shared queues of each node, from the highest priority
+    // to the lowest, the locked kinds are guarded by `lock`
+    tp_lane_t *lanes;
+    uint32_t nlane;
+    // NUMA nodes having their own queues, 1 if it's not NUMA aware
+    uint32_t nnode;
+    // loaded when affinity or NUMA awareness is enabled
+    tp_topo_t *topo;
+
+    // whether events are recorded, and the event rings of every thread
+    // which recorded one, pushed lock-free and freed by tp_destroy()
+    uint32_t tracing;
+    tp_trace_buf_t *trace_bufs;
+    // tells the pool apart in the threads' buffer caches, never reused
+    uint32_t trace_id;
+    // events before it are left out of dumps
+    uint64_t trace_start_ns;
     pthread_mutex_t lock;
-    pthread_cond_t has_task;
+
+    // stack of parked workers, producers pop one and wake it directly
+    pthread_spinlock_t idle_lock;
+    tp_worker_t **idle;
+    uint32_t nidle;
+    // wakeups issued, and posts which found no idle worker to wake
+    uint64_t wake_calls;
+    uint64_t wake_skipped;
+    // set when the workers are being torn down,
+    // then `drain` (tp_drain_t) tells what to do with the queued tasks
+    uint32_t stopping;
+    uint32_t drain;
+
+    // delayed and periodic tasks keyed by due time
+    pthread_mutex_t timer_lock;
+    heap_t timers;
+    // due time of the earliest timer, UINT64_MAX if there is none
+    uint64_t timer_next_ns;
+    // when the parked worker watching the timers wakes up,
+    // UINT64_MAX if nobody is
+    uint64_t timer_armed_ns;
 
     uint32_t active_tasks;
     pthread_cond_t no_task;
+
+    // tasks in the shared queues, only counted with `attr.max_queued`
+    uint32_t nqueued;
+    // producers waiting for room, and the futex word they wait on
+    uint32_t nblocked;
+    uint32_t room_seq;
+    tp_overflow_stats_t overflow_stats;
+    // counters of the threads which aren't workers of the pool
+    tp_metrics_stripe_t stripes[TP_METRICS_STRIPES];
+
+    // live workers and their bounds, written under `resize_lock`
+    pthread_mutex_t resize_lock;
+    uint32_t nlive;
+    uint32_t min_threads;
+    uint32_t max_threads;
+    // when a worker last took a task, only in elastic mode
+    uint64_t last_take_ns;
+    uint64_t spawned;
+    uint64_t retired;
+
+    // shared free list of pooled tasks of each node and the slabs backing them
+    pthread_mutex_t slab_lock;
+    tp_task_t **free_tasks;
+    tp_slab_t *slabs;
+    tp_task_stats_t task_stats;
 };
 
 
@@ -56,6 +580,19 @@ struct thread_local_s
 /* ---------------- Thread Pool API ---------------- */
 
 
+/**
+ * Initialize the attributes with default values:
+ * TP_SCHED_SHARED scheduling, 1024 slots per deque,
+ * an unbounded TP_QUEUE_LIST shared queue, no spinning,
+ * three priority classes, an aging threshold of 16,
+ * floating workers, no NUMA awareness and a fixed number of
+ * threads (elastic mode spawns after 1ms and retires after 60s).
+ *
+ * @param attr attributes to be initialized
+ */
+void tp_attr_init(tp_attr_t *attr);
+
+
 /**
  * Initialize a thread pool. No threads would be created or
  * started in this routine.
@@ -68,9 +605,22 @@ struct thread_local_s
 bool tp_init(thread_pool_t *tp, uint32_t nthreads);
 
 
+/**
+ * Initialize a thread pool with attributes.
+ *
+ * @param tp thread pool to be initialized
+ * @param nthreads number of threads to be created in pool
+ * @param attr attributes of the pool, NULL for default ones
+ * @return true: succeed
+ *         false: failed
+ */
+bool tp_init_attr(thread_pool_t *tp, uint32_t nthreads, const tp_attr_t *attr);
+
+
 /**
  * Start an initialized thread pool. Threads will be created
- * and started in this routine.
+ * and started in this routine. A pool shut down by tp_shutdown()
+ * may be started again.
  *
  * @param tp non-started thread pool
  * @return true: succeed
@@ -80,13 +630,57 @@ bool tp_start(thread_pool_t *tp);
 
 
 /**
- * Destroy an thread pool.
+ * Stop the workers cooperatively: running tasks are never interrupted,
+ * queued ones are run or discarded according to `drain`, and the
+ * pending timers are discarded. Tasks discarded are freed, completing
+ * their futures as cancelled and counting their groups down, their
+ * `cleanup` is called unless `drain` is TP_DRAIN_RUNNING. New posts
+ * fail from the call on.
+ *
+ * If the workers haven't exited within `timeout_us`, the queued tasks
+ * left are discarded and false is returned, the workers exit after
+ * their current task. Call it again, or tp_destroy(), to wait for them.
+ *
+ * @param tp started thread pool
+ * @param drain tp_drain_t
+ * @param timeout_us TP_TIMEOUT_INFINITE to wait as long as it takes
+ * @return true: every worker exited
+ *         false: timed out
+ */
+bool tp_shutdown(thread_pool_t *tp, tp_drain_t drain, uint64_t timeout_us);
+
+
+/**
+ * Destroy an thread pool. If it wasn't shut down, the running tasks are
+ * finished and the queued ones are discarded (TP_DRAIN_DISCARD).
  *
  * @param tp thread pool to be destroy
  */
 void tp_destroy(thread_pool_t *tp);
 
 
+/**
+ * Change the bounds of the number of threads at runtime. Workers are
+ * started at once up to `min_threads`. Idle ones above `max_threads`
+ * retire at once, busy ones after finishing their current task.
+ * Running and queued tasks aren't disturbed.
+ *
+ * @param tp started thread pool
+ * @param min_threads threads kept even when idle
+ * @param max_threads at most the larger of the `nthreads` and
+ *        `attr.max_threads` the pool was initialized with
+ * @return true: succeed
+ *         false: invalid bounds, or failed to start the threads
+ */
+bool tp_resize(thread_pool_t *tp, uint32_t min_threads, uint32_t max_threads);
+
+
+/**
+ * Number of live threads of the pool.
+ */
+#define tp_live_threads(tp) __atomic_load_n(&(tp)->nlive, __ATOMIC_RELAXED)
+
+
 /**
  * Waiting for all threads in pool to stop.
  *
@@ -102,6 +696,15 @@ void tp_join(thread_pool_t *tp);
  * Post an task to the thread pool. The task would
  * be queued and waiting for threads consuming it.
  *
+ * In TP_SCHED_STEALING mode, a task posted from a worker
+ * of the same pool is pushed to the worker's own deque.
+ *
+ * When the shared queues are full, `attr.overflow` is applied.
+ *
+ * Posting fails once tp_shutdown() is called, until tp_start() restarts
+ * the pool, even from the tasks it drains. A task which isn't posted
+ * still belongs to the caller, its cleanup isn't called.
+ *
  * @param tp started thread pool
  * @param task an task in heap, which would be released
  *        by the pool after it's been consumed
@@ -111,8 +714,101 @@ void tp_join(thread_pool_t *tp);
 bool tp_post_task(thread_pool_t *tp, tp_task_t *task);
 
 
+/**
+ * Post an task with the given priority, see tp_post_task().
+ *
+ * Workers serve the higher classes first. In TP_SCHED_STEALING mode
+ * only TP_PRIORITY_NORMAL tasks go to the deque of the posting worker,
+ * the others are always queued to be seen by every worker.
+ *
+ * @param tp started thread pool
+ * @param task same as tp_post_task()
+ * @param priority TP_PRIORITY_HIGH, TP_PRIORITY_NORMAL, TP_PRIORITY_LOW,
+ *        or any class below `npriority` of the pool
+ * @return true: succeed
+ *         false: failed
+ */
+bool tp_post_task_priority(thread_pool_t *tp, tp_task_t *task, uint32_t priority);
+
+
+/**
+ * Post an task to the queues of the NUMA node owning its data.
+ * Workers of that node take it first, the others only when
+ * their own node has no work. Without NUMA awareness, or for an
+ * unknown node, it's the same as tp_post_task().
+ *
+ * @param tp started thread pool
+ * @param task same as tp_post_task()
+ * @param node OS id of the node, TP_NODE_ANY for the poster's node
+ * @return true: succeed
+ *         false: failed
+ */
+bool tp_post_task_node(thread_pool_t *tp, tp_task_t *task, uint32_t node);
+
+
+/**
+ * Set the priority of an task before posting it.
+ */
+#define tp_task_set_priority(task, prio) ((task)->priority = (prio))
+
+
+/**
+ * Number of tasks waiting in the shared queues, racy.
+ *
+ * @param tp thread pool
+ * @return tasks of all classes, not counting the workers' deques
+ */
+uint32_t tp_queue_len(thread_pool_t *tp);
+
+
+/**
+ * Get the counters of the overflow policy.
+ *
+ * @param tp thread pool
+ * @param stats filled with the counters
+ */
+void tp_overflow_stats(thread_pool_t *tp, tp_overflow_stats_t *stats);
+
+
+/**
+ * Sum the counters and merge the histograms of all the workers.
+ * Cheap for the workers, they're never stopped, so the figures
+ * may be off by the tasks in flight.
+ *
+ * @param tp thread pool
+ * @param metrics filled with the snapshot
+ */
+void tp_metrics_snapshot(thread_pool_t *tp, tp_metrics_t *metrics);
+
+
+/**
+ * Copy the counters and histograms of one worker, racy.
+ *
+ * @param tp thread pool
+ * @param index worker index, below `nthread`
+ * @param metrics filled with the copy
+ * @return true: succeed
+ *         false: there is no such worker
+ */
+bool tp_worker_metrics(thread_pool_t *tp, uint32_t index, tp_worker_metrics_t *metrics);
+
+
+/**
+ * Get the queue statistics of a priority class.
+ *
+ * @param tp thread pool
+ * @param priority the class, larger ones are treated as the lowest
+ * @param stats filled with the counters
+ */
+void tp_priority_stats(thread_pool_t *tp, uint32_t priority, tp_priority_stats_t *stats);
+
+
 /**
  * Waiting for all currently running tasks to finish.
+ * Returns at once if there is none.
+ *
+ * Tasks of all users of the pool are waited, use task groups
+ * to wait for specific tasks.
  *
  * @param tp thread pool
  * @return true: there is no running tasks now
@@ -131,21 +827,366 @@ bool tp_join_tasks(thread_pool_t *tp);
  * However, it doesn't matter in most situations,
  * just take it simply as a repetition of tp_post_task().
  *
+ * The batch is linked into the shared queue at once and
+ * up to `ntask` idle workers are woken up. Consecutive tasks
+ * of the same priority are linked at once.
+ *
+ * When the shared queues are full, the tasks which don't fit are
+ * posted one by one as tp_post_task() does, or not at all with
+ * TP_OVERFLOW_FAIL.
+ *
  * @param tp thread pool
  * @param tasks array of tasks
  * @param ntask number of tasks in the array
- * @return number of successfully posted tasks
+ * @return number of successfully posted tasks, they're always the
+ *         first ones of the array, the others aren't posted and
+ *         still belong to the caller
  */
 int tp_post_tasks(thread_pool_t *tp, tp_task_t *tasks[], int ntask);
 
 
 /**
- * In task function, get the thread local itself.
- * @return thread local itself or NULL when error occurred
+ * Post an task and get a future receiving the value its runner returns.
+ *
+ * @param tp started thread pool
+ * @param task same as tp_post_task()
+ * @return future to be released by tp_future_release(),
+ *         or NULL when failed, in which case the task isn't posted
+ */
+tp_future_t *tp_post_task_future(thread_pool_t *tp, tp_task_t *task);
+
+
+/* ---------------- Trace API ---------------- */
+
+
+/**
+ * Start recording the events of the pool: posting, starting and ending
+ * tasks, parking and waking up workers. Each thread records into its own
+ * lock-free ring of `attr.trace_events` events, overwriting the oldest.
+ *
+ * Only available when the library is built with TP_TRACE defined
+ * (cmake -DTP_TRACE=ON), the recording calls are compiled out otherwise.
+ *
+ * @param tp thread pool
+ * @return true: succeed
+ *         false: the library is built without TP_TRACE
+ */
+bool tp_trace_start(thread_pool_t *tp);
+
+
+/**
+ * Stop recording, the events are kept for tp_trace_dump().
+ *
+ * @param tp thread pool
+ */
+void tp_trace_stop(thread_pool_t *tp);
+
+
+/**
+ * Write the events recorded since the last tp_trace_start() in the
+ * Chrome trace event format, to be opened by chrome://tracing or Perfetto.
+ * It may be called while recording, events being overwritten are left out.
+ *
+ * @param tp thread pool
+ * @param out file to write to
+ * @return true: succeed
+ *         false: failed to write, or the library is built without TP_TRACE
+ */
+bool tp_trace_dump(thread_pool_t *tp, FILE *out);
+
+
+/* ---------------- Timer API ---------------- */
+
+
+/**
+ * Post an task to be queued after `delay_us` microseconds.
+ *
+ * Idle workers watch the timers instead of a separate thread:
+ * one of them parks until the earliest one is due, and busy workers
+ * check them between tasks. tp_join_tasks() doesn't wait for tasks
+ * which aren't due yet.
+ *
+ * @param tp thread pool
+ * @param task same as tp_post_task()
+ * @param delay_us delay in microseconds
+ * @return true: succeed
+ *         false: failed
+ */
+bool tp_post_delayed(thread_pool_t *tp, tp_task_t *task, uint64_t delay_us);
+
+
+/**
+ * Run an task every `interval_us` microseconds, the first time after
+ * `delay_us`. Runs are scheduled at a fixed rate, the ones missed
+ * while the task was late are skipped, and a task never overlaps itself.
+ *
+ * The task is kept by the pool between runs, until it's cancelled
+ * by tp_cancel_periodic() or the pool is destroyed. It must not
+ * have a future or a group.
+ *
+ * @param tp thread pool
+ * @param task same as tp_post_task()
+ * @param delay_us delay of the first run in microseconds
+ * @param interval_us period in microseconds, must not be 0
+ * @return true: succeed
+ *         false: failed
+ */
+bool tp_post_periodic(thread_pool_t *tp, tp_task_t *task,
+                      uint64_t delay_us, uint64_t interval_us);
+
+
+/**
+ * Stop a periodic task, it may be called from the task itself.
+ * A run in progress isn't interrupted. The task is freed by the
+ * pool when it's due next time, or after the run in progress,
+ * it must not be used after calling this. Its successors are
+ * released then, as they wait for its last run.
+ *
+ * @param task task posted by tp_post_periodic()
+ */
+void tp_cancel_periodic(tp_task_t *task);
+
+
+/* ---------------- Task Group API ---------------- */
+
+
+/**
+ * Initialize a task group, which is a countdown latch of tasks.
+ *
+ * @param group group to be initialized
+ */
+void tp_group_init(tp_group_t *group);
+
+
+/**
+ * Post an task belonging to the group.
+ *
+ * @param tp started thread pool
+ * @param group the group counting the task
+ * @param task same as tp_post_task()
+ * @return true: succeed
+ *         false: failed, the task isn't posted
+ */
+bool tp_group_post(thread_pool_t *tp, tp_group_t *group, tp_task_t *task);
+
+
+/**
+ * Waiting for all tasks of the group to finish. Returns at once
+ * if there is none, otherwise spins shortly before blocking.
+ *
+ * @param tp thread pool the tasks were posted to
+ * @param group group to be waited
+ * @param help run queued tasks of `tp` in the calling thread while waiting
+ */
+void tp_group_wait(thread_pool_t *tp, tp_group_t *group, bool help);
+
+
+/**
+ * Add `n` to the count of the group without posting tasks,
+ * to use it as a plain countdown latch.
+ */
+void tp_group_add(tp_group_t *group, uint32_t n);
+
+
+/**
+ * Count the group down by one, waking up the waiters when it reaches zero.
+ */
+void tp_group_done(tp_group_t *group);
+
+
+/**
+ * Number of unfinished tasks of the group.
+ */
+#define tp_group_pending(group) \
+(__atomic_load_n(&(group)->pending, __ATOMIC_ACQUIRE) & ~TP_GROUP_WAITING)
+
+
+/* ---------------- Task Graph API ---------------- */
+
+
+/**
+ * Make `next` wait for `task`. Once posted, `next` is held until all
+ * the tasks it waits for finished, then the thread finishing the last
+ * one runs it right away if it's of the same pool, or queues it.
+ * If one of them is destroyed without running, `next` is discarded
+ * when it's posted, calling its cleanup.
+ *
+ * Add the edges before posting `task`. Chains and joins of any shape
+ * can be built, posting with tp_post_task() and the calls built on it,
+ * delayed and periodic posting don't wait.
+ *
+ * @param task predecessor
+ * @param next successor
+ * @return true: succeed
+ *         false: failed
+ */
+bool tp_task_then(tp_task_t *task, tp_task_t *next);
+
+
+/* ---------------- Handoff API ---------------- */
+
+
+/**
+ * In task function, pass the running task on to another pool: once the
+ * task function returns, the same task is posted to `tp` to run
+ * `runner` with the same args, with no new allocation and without
+ * going back through the current pool's queue. Its cleanup, future,
+ * group and successors wait for the last stage. If `tp` refuses it,
+ * the next stage runs on the calling thread.
+ *
+ * Pools share no state, so an I/O pool may finish a read and hand the
+ * decoding to a CPU pool. A pooled task needs the pool it was created
+ * from to outlive it. The task itself is reused, but a TP_QUEUE_LIST
+ * pool still allocates a queue node to queue it, as for any post:
+ * give `tp` TP_QUEUE_RING or TP_QUEUE_INTRUSIVE to hand off without
+ * allocating.
+ *
+ * @param tp pool to run the next stage
+ * @param runner next stage, the previous one is forgotten
+ * @return true: succeed
+ *         false: not in a task function, or the task is periodic
+ */
+bool tp_task_handoff(thread_pool_t *tp, runnable_t runner);
+
+
+/* ---------------- Parallel API ---------------- */
+
+
+/**
+ * Call `fn` over subranges covering [begin, end) once, some of them on
+ * the workers. The calling thread runs the range grain by grain and
+ * splits the upper half of what's left off to the pool only while other
+ * threads are short of work, so a loop costs a few pooled tasks rather
+ * than one per grain. It returns once all of it was run, running queued
+ * tasks meanwhile, so it works in a task or a pool without workers too.
+ *
+ * @param tp thread pool
+ * @param grain largest subrange `fn` is called on, 0 to pick a few
+ *        per thread
+ * @param ctx passed to `fn`
+ * @return true: succeed
+ *         false: failed, `fn` wasn't called
+ */
+bool tp_parallel_for(thread_pool_t *tp, uint64_t begin, uint64_t end, uint64_t grain,
+                     tp_range_fn_t fn, void *ctx);
+
+
+/**
+ * Reduce [begin, end) split like tp_parallel_for(). Each piece
+ * accumulates into its own copy of `identity` with `map`, the pieces
+ * are combined into `result` in the order they finish, so `combine`
+ * must be associative and commutative.
+ *
+ * @param identity accumulator of an empty range, `size` bytes
+ * @param result receives the reduction, initialized from `identity`
+ * @return true: succeed
+ *         false: failed, `map` wasn't called
+ */
+bool tp_parallel_reduce(thread_pool_t *tp, uint64_t begin, uint64_t end, uint64_t grain,
+                        tp_reduce_fn_t map, tp_combine_fn_t combine,
+                        const void *identity, size_t size, void *result, void *ctx);
+
+
+/* ---------------- Future API ---------------- */
+
+
+/**
+ * Waiting for the task to finish, spinning shortly before blocking.
+ *
+ * @param future future returned by tp_post_task_future()
+ * @return the value returned by the runner, NULL if the task was
+ *         destroyed without being run
+ */
+void *tp_future_wait(tp_future_t *future);
+
+
+/**
+ * Waiting for the task to finish at most `timeout_us` microseconds.
+ *
+ * @param future future returned by tp_post_task_future()
+ * @param timeout_us timeout in microseconds
+ * @param result receives the value returned by the runner, may be NULL
+ * @return true: the task finished (or was cancelled)
+ *         false: timed out
+ */
+bool tp_future_wait_for(tp_future_t *future, uint64_t timeout_us, void **result);
+
+
+/**
+ * Get the result without blocking.
+ *
+ * @param future future returned by tp_post_task_future()
+ * @param result receives the value returned by the runner, may be NULL
+ * @return true: the task finished (or was cancelled)
+ *         false: the task is still pending
+ */
+bool tp_future_try_get(tp_future_t *future, void **result);
+
+
+/**
+ * Whether the task was destroyed without being run.
+ */
+#define tp_future_cancelled(future) \
+(__atomic_load_n(&(future)->state, __ATOMIC_ACQUIRE) == TP_FUTURE_CANCELLED)
+
+
+/**
+ * Release the caller's reference of the future. It's safe to release
+ * a pending future, the result is discarded then.
+ *
+ * @param future future returned by tp_post_task_future()
+ */
+void tp_future_release(tp_future_t *future);
+
+
+/**
+ * Get the pool of the calling thread: the pool of the worker on a
+ * worker thread, otherwise the pool last initialized on it until it's
+ * destroyed. A thread which neither is a worker nor initialized a pool
+ * gets NULL, even while other threads' pools are alive. It only reads
+ * thread local variables, so it works with any number of pools.
+ *
+ * @return the pool, or NULL if there isn't any for the calling thread
  */
 thread_pool_t *tp_self();
 
 
+/**
+ * Get the context of the worker running on the calling thread: its
+ * pool, its index among the pool's `workers`, its deque, its metrics.
+ * It only reads a thread local variable.
+ *
+ * @return the worker, or NULL if it's not a worker thread
+ */
+tp_worker_t *tp_self_worker();
+
+
+/* ---------------- Arena API ---------------- */
+
+
+/**
+ * In task function, allocate temporary memory from the scratch arena of
+ * the worker running it, without any locking. Everything allocated is
+ * released at once when the worker finishes the task it took, unless
+ * `attr.arena_keep` is set, then it stays until tp_arena_reset().
+ * Tasks run inline by the task, such as while helping in
+ * tp_group_wait(), share its arena.
+ *
+ * @param size number of bytes, aligned on ARENA_ALIGN
+ * @return the memory, or NULL if it's not a worker thread or
+ *         malloc() failed
+ */
+void *tp_arena_alloc(size_t size);
+
+
+/**
+ * Release everything allocated with tp_arena_alloc() on the calling
+ * worker, keeping the memory for the next allocations. Nothing is done
+ * if it's not a worker thread.
+ */
+void tp_arena_reset();
+
+
 /* ---------------- Task API ---------------- */
 
 
@@ -157,7 +1198,8 @@ thread_pool_t *tp_self();
  * @param cleanup the cleanup part of the task
  * @param args the arguments to be passed to the `runner` & `cleanup`
  * @param args_len the memory size in bytes of the memory area that the args pointing to,
- *                 which will be copied to the inner allocated memory area
+ *                 which will be copied to the inner allocated memory area, or to the
+ *                 task itself when it's not larger than TP_TASK_INLINE_ARGS
  * @return true: succeed
  *         false: failed
  */
@@ -197,6 +1239,42 @@ tp_task_t *tp_task_create(runnable_t runner, cleanup_t cleanup,
 void tp_task_free(tp_task_t *task);
 
 
+/**
+ * Create an task from the pool's slab allocator instead of malloc().
+ *
+ * Workers of `tp` allocate from and free to a private cache, other
+ * threads go through a shared free list. Freeing it with tp_task_free()
+ * (which the pool does after running it) recycles it to `tp`, so the
+ * pool must outlive the task.
+ *
+ * @param tp the pool owning the task memory
+ * @param runner the running part of the task
+ * @param cleanup the cleanup part of the task
+ * @param args the arguments to be passed to the `runner` & `cleanup`
+ * @param args_len same as tp_task_create()
+ * @return task created or NULL when failed
+ */
+tp_task_t *tp_task_create_pooled(thread_pool_t *tp, runnable_t runner,
+                                 cleanup_t cleanup, void *args, size_t args_len);
+
+
+/**
+ * Free an task created by tp_task_create_pooled(), same as tp_task_free().
+ *
+ * @param task task to be freed
+ */
+void tp_task_free_pooled(tp_task_t *task);
+
+
+/**
+ * Get the statistics of the pool's task allocator.
+ *
+ * @param tp thread pool
+ * @param stats filled with the counters
+ */
+void tp_task_stats(thread_pool_t *tp, tp_task_stats_t *stats);
+
+
 /**
  * Create a new task and copy the data of the old task to the new one.
  *
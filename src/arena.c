@@ -0,0 +1,150 @@
+#include "arena.h"
+
+#include <strings.h>
+#include <stdlib.h>
+
+
+// header of a chunk rounded up so its data is aligned
+#define ARENA_HEADER \
+((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+#define _arena_data(chunk) ((char *) (chunk) + ARENA_HEADER)
+
+
+arena_chunk_t *_arena_chunk_create(size_t size)
+{
+    arena_chunk_t *chunk;
+
+    chunk = malloc(ARENA_HEADER + size);
+
+    if (chunk) {
+        chunk->next = NULL;
+        chunk->size = size;
+        chunk->used = 0;
+    }
+
+    return chunk;
+}
+
+
+void _arena_chunks_free(arena_chunk_t *chunk)
+{
+    arena_chunk_t *next;
+
+    while (chunk) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+
+/* ---------------- Arena API ---------------- */
+
+
+bool arena_init(arena_t *arena, size_t chunk_size)
+{
+    bool status = false;
+
+    if (arena == NULL || chunk_size == 0) {
+        goto EXIT;
+    }
+
+    bzero(arena, sizeof(arena_t));
+    arena->chunk_size = (chunk_size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+void arena_destroy(arena_t *arena)
+{
+    _arena_chunks_free(arena->chunks);
+    _arena_chunks_free(arena->large);
+
+    arena->chunks = NULL;
+    arena->current = NULL;
+    arena->large = NULL;
+    arena->used = 0;
+}
+
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk;
+    arena_chunk_t *next;
+
+    if (size == 0) {
+        size = 1;
+    }
+
+    if (size > arena->chunk_size) {
+        chunk = _arena_chunk_create(size);
+
+        if (chunk == NULL) {
+            return NULL;
+        }
+
+        chunk->used = size;
+        chunk->next = arena->large;
+        arena->large = chunk;
+        arena->used += size;
+
+        return _arena_data(chunk);
+    }
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    chunk = arena->current;
+
+    // The chunks after the current one are empty, kept from before a reset
+    while (chunk == NULL || chunk->size - chunk->used < size) {
+        if (chunk && chunk->next) {
+            chunk = chunk->next;
+            continue;
+        }
+
+        next = _arena_chunk_create(arena->chunk_size);
+
+        if (next == NULL) {
+            return NULL;
+        }
+
+        if (chunk) {
+            chunk->next = next;
+        } else {
+            arena->chunks = next;
+        }
+
+        chunk = next;
+    }
+
+    arena->current = chunk;
+    chunk->used += size;
+    arena->used += size;
+
+    return _arena_data(chunk) + chunk->used - size;
+}
+
+
+void arena_reset(arena_t *arena)
+{
+    arena_chunk_t *chunk;
+
+    // Only the chunks up to the current one have been used
+    for (chunk = arena->chunks; chunk; chunk = chunk->next) {
+        chunk->used = 0;
+
+        if (chunk == arena->current) {
+            break;
+        }
+    }
+
+    _arena_chunks_free(arena->large);
+
+    arena->current = arena->chunks;
+    arena->large = NULL;
+    arena->used = 0;
+}
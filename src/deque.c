@@ -0,0 +1,141 @@
+#include "deque.h"
+
+#include <stddef.h>
+#include <strings.h>
+#include <stdlib.h>
+
+
+/* ---------------- Deque API ---------------- */
+
+
+bool deque_init(deque_t *deque, uint32_t capacity)
+{
+    bool status = false;
+    uint32_t size = 1;
+
+    if (deque == NULL || capacity == 0 || capacity > (1u << 31)) {
+        goto EXIT;
+    }
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    bzero(deque, sizeof(deque_t));
+
+    deque->buffer = calloc(size, sizeof(qdata_t));
+
+    if (deque->buffer == NULL) {
+        goto EXIT;
+    }
+
+    deque->mask = size - 1;
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+void deque_destroy(deque_t *deque)
+{
+    if (deque) {
+        free(deque->buffer);
+
+        bzero(deque, sizeof(deque_t));
+    }
+}
+
+
+bool deque_push(deque_t *deque, qdata_t data)
+{
+    int64_t b;
+    int64_t t;
+
+    b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    if (b - t > (int64_t) deque->mask) {
+        return false;
+    }
+
+    __atomic_store(&deque->buffer[b & deque->mask], &data, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+
+bool deque_pop(deque_t *deque, qdata_t *data)
+{
+    bool status = false;
+    int64_t b;
+    int64_t t;
+
+    b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        // Empty, restore bottom
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        goto EXIT;
+    }
+
+    __atomic_load(&deque->buffer[b & deque->mask], data, __ATOMIC_RELAXED);
+    status = true;
+
+    if (t == b) {
+        // The last element, race against thieves for it
+        if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            status = false;
+        }
+
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+EXIT:
+    return status;
+}
+
+
+bool deque_steal(deque_t *deque, qdata_t *data)
+{
+    int64_t b;
+    int64_t t;
+    qdata_t tmp;
+
+    t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b) {
+        return false;
+    }
+
+    __atomic_load(&deque->buffer[t & deque->mask], &tmp, __ATOMIC_RELAXED);
+
+    if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    *data = tmp;
+
+    return true;
+}
+
+
+uint32_t deque_len(deque_t *deque)
+{
+    int64_t b;
+    int64_t t;
+
+    b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    return b > t ? (uint32_t) (b - t) : 0;
+}
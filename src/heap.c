@@ -0,0 +1,151 @@
+#include "heap.h"
+
+#include <stddef.h>
+#include <strings.h>
+#include <stdlib.h>
+
+
+#define HEAP_ARITY 4
+#define HEAP_MIN_CAPACITY 16
+
+
+/* ---------------- Heap API ---------------- */
+
+
+bool heap_init(heap_t *heap, uint32_t capacity)
+{
+    bool status = false;
+
+    if (heap == NULL) {
+        goto EXIT;
+    }
+
+    bzero(heap, sizeof(heap_t));
+
+    if (capacity > 0) {
+        heap->nodes = malloc(capacity * sizeof(heap_node_t));
+
+        if (heap->nodes == NULL) {
+            goto EXIT;
+        }
+
+        heap->capacity = capacity;
+    }
+
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+void heap_destroy(heap_t *heap)
+{
+    if (heap) {
+        free(heap->nodes);
+
+        bzero(heap, sizeof(heap_t));
+    }
+}
+
+
+bool heap_push(heap_t *heap, uint64_t key, qdata_t data)
+{
+    uint32_t i;
+    uint32_t parent;
+    uint32_t capacity;
+    heap_node_t *nodes;
+
+    if (heap->len == heap->capacity) {
+        capacity = heap->capacity ? heap->capacity * 2 : HEAP_MIN_CAPACITY;
+        nodes = realloc(heap->nodes, capacity * sizeof(heap_node_t));
+
+        if (nodes == NULL) {
+            return false;
+        }
+
+        heap->nodes = nodes;
+        heap->capacity = capacity;
+    }
+
+    // Sift up, moving the parents down instead of swapping
+    i = heap->len++;
+
+    while (i > 0) {
+        parent = (i - 1) / HEAP_ARITY;
+
+        if (heap->nodes[parent].key <= key) {
+            break;
+        }
+
+        heap->nodes[i] = heap->nodes[parent];
+        i = parent;
+    }
+
+    heap->nodes[i].key = key;
+    heap->nodes[i].data = data;
+
+    return true;
+}
+
+
+bool heap_top(heap_t *heap, heap_node_t *node)
+{
+    if (heap->len == 0) {
+        return false;
+    }
+
+    *node = heap->nodes[0];
+
+    return true;
+}
+
+
+bool heap_pop(heap_t *heap, heap_node_t *node)
+{
+    uint32_t i = 0;
+    uint32_t j;
+    uint32_t child;
+    uint32_t last;
+    heap_node_t tail;
+
+    if (heap->len == 0) {
+        return false;
+    }
+
+    if (node) {
+        *node = heap->nodes[0];
+    }
+
+    tail = heap->nodes[--heap->len];
+
+    // Sift the last node down from the root
+    while (1) {
+        child = i * HEAP_ARITY + 1;
+
+        if (child >= heap->len) {
+            break;
+        }
+
+        last = child + HEAP_ARITY < heap->len ? child + HEAP_ARITY : heap->len;
+
+        for (j = child + 1; j < last; ++j) {
+            if (heap->nodes[j].key < heap->nodes[child].key) {
+                child = j;
+            }
+        }
+
+        if (tail.key <= heap->nodes[child].key) {
+            break;
+        }
+
+        heap->nodes[i] = heap->nodes[child];
+        i = child;
+    }
+
+    if (heap->len > 0) {
+        heap->nodes[i] = tail;
+    }
+
+    return true;
+}
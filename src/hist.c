@@ -0,0 +1,116 @@
+#include "hist.h"
+
+#include <strings.h>
+
+
+/* ---------------- Histogram API ---------------- */
+
+
+void hist_init(hist_t *hist)
+{
+    bzero(hist, sizeof(hist_t));
+    hist->min = UINT64_MAX;
+}
+
+
+uint32_t hist_bucket(uint64_t value)
+{
+    uint32_t msb;
+
+    if (value < 2 * HIST_SUB) {
+        return (uint32_t) value;
+    }
+
+    msb = 63 - (uint32_t) __builtin_clzll(value);
+
+    // The 3 bits below the leading one pick the sub-bucket
+    return 2 * HIST_SUB + (msb - 4) * HIST_SUB
+           + (uint32_t) ((value >> (msb - 3)) & (HIST_SUB - 1));
+}
+
+
+uint64_t hist_bucket_upper(uint32_t bucket)
+{
+    uint32_t msb;
+    uint64_t sub;
+
+    if (bucket < 2 * HIST_SUB) {
+        return bucket;
+    }
+
+    msb = (bucket - 2 * HIST_SUB) / HIST_SUB + 4;
+    sub = (bucket - 2 * HIST_SUB) % HIST_SUB;
+
+    if (msb == 63 && sub == HIST_SUB - 1) {
+        return UINT64_MAX;
+    }
+
+    return ((HIST_SUB + sub + 1) << (msb - 3)) - 1;
+}
+
+
+void hist_record(hist_t *hist, uint64_t value)
+{
+    ++hist->counts[hist_bucket(value)];
+    ++hist->total;
+    hist->sum += value;
+
+    if (value < hist->min) {
+        hist->min = value;
+    }
+
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+
+void hist_merge(hist_t *dst, const hist_t *src)
+{
+    uint32_t i;
+
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        dst->counts[i] += src->counts[i];
+    }
+
+    dst->total += src->total;
+    dst->sum += src->sum;
+
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+
+uint64_t hist_percentile(const hist_t *hist, double p)
+{
+    uint32_t i;
+    uint64_t rank;
+    uint64_t upper;
+    uint64_t seen = 0;
+
+    if (hist->total == 0) {
+        return 0;
+    }
+
+    rank = (uint64_t) (p / 100.0 * (double) hist->total + 0.5);
+
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        seen += hist->counts[i];
+
+        if (seen >= rank) {
+            upper = hist_bucket_upper(i);
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+
+    return hist->max;
+}
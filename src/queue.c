@@ -106,6 +106,36 @@ uint32_t queue_len(queue_t *queue)
 }
 
 
+bool queue_append(queue_t *queue, queue_t *other)
+{
+    bool status = false;
+
+    if (queue == NULL || other == NULL || queue == other) {
+        goto EXIT;
+    }
+
+    if (other->len > 0) {
+        if (queue->len == 0) {
+            queue->head = other->head;
+        } else {
+            queue->tail->next = other->head;
+        }
+
+        queue->tail = other->tail;
+        queue->len += other->len;
+
+        other->head = NULL;
+        other->tail = NULL;
+        other->len = 0;
+    }
+
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
 /* ---------------- qnode_t API ---------------- */
 
 
@@ -0,0 +1,187 @@
+#include "ring.h"
+
+#include <stddef.h>
+#include <strings.h>
+#include <stdlib.h>
+
+
+/* ---------------- Ring API ---------------- */
+
+
+bool ring_init(ring_t *ring, uint32_t capacity)
+{
+    bool status = false;
+    uint32_t i;
+    uint32_t size = 1;
+
+    if (ring == NULL || capacity == 0 || capacity > (1u << 31)) {
+        goto EXIT;
+    }
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    bzero(ring, sizeof(ring_t));
+
+    ring->cells = calloc(size, sizeof(ring_cell_t));
+
+    if (ring->cells == NULL) {
+        goto EXIT;
+    }
+
+    for (i = 0; i < size; ++i) {
+        ring->cells[i].seq = i;
+    }
+
+    ring->mask = size - 1;
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+void ring_destroy(ring_t *ring)
+{
+    if (ring) {
+        free(ring->cells);
+
+        bzero(ring, sizeof(ring_t));
+    }
+}
+
+
+bool ring_enqueue(ring_t *ring, qdata_t data)
+{
+    ring_cell_t *cell;
+    uint64_t pos;
+    uint64_t seq;
+    int64_t diff;
+
+    pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (int64_t) seq - (int64_t) pos;
+
+        if (diff == 0) {
+            // The slot is free in this lap, try to claim it
+            if (__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The slot still holds an element of the previous lap
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->data = data;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+
+uint32_t ring_enqueue_bulk(ring_t *ring, const qdata_t *data, uint32_t n)
+{
+    ring_cell_t *cell;
+    uint64_t pos;
+    uint64_t seq;
+    uint32_t i;
+    uint32_t count;
+
+    pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        // Count the free slots from `pos`. Consumers can only free
+        // more slots, so they stay free unless `head` moves, which
+        // the CAS below detects.
+        for (count = 0; count < n; ++count) {
+            cell = &ring->cells[(pos + count) & ring->mask];
+            seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+            if (seq != pos + count) {
+                break;
+            }
+        }
+
+        if (count == 0) {
+            cell = &ring->cells[pos & ring->mask];
+            seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+
+            // Full
+            if ((int64_t) seq - (int64_t) pos < 0) {
+                return 0;
+            }
+
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&ring->head, &pos, pos + count, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    for (i = 0; i < count; ++i) {
+        cell = &ring->cells[(pos + i) & ring->mask];
+        cell->data = data[i];
+        __atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+
+    return count;
+}
+
+
+bool ring_dequeue(ring_t *ring, qdata_t *data)
+{
+    ring_cell_t *cell;
+    uint64_t pos;
+    uint64_t seq;
+    int64_t diff;
+
+    pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    while (1) {
+        cell = &ring->cells[pos & ring->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (int64_t) seq - (int64_t) (pos + 1);
+
+        if (diff == 0) {
+            // The slot was written in this lap, try to claim it
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Nothing written yet
+            return false;
+        } else {
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    *data = cell->data;
+    // Release the slot for the next lap
+    __atomic_store_n(&cell->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+
+uint32_t ring_len(ring_t *ring)
+{
+    uint64_t head;
+    uint64_t tail;
+
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    return head > tail ? (uint32_t) (head - tail) : 0;
+}
@@ -1,20 +1,109 @@
+// pthread_attr_setaffinity_np(), pthread_timedjoin_np() and sched_getcpu()
+#define _GNU_SOURCE
+
 #include "thread_pool.h"
+#include "tp_sync.h"
+#include "tp_topo.h"
+#include "tp_trace.h"
 
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
+
+
+#define TP_DEFAULT_DEQUE_CAPACITY 1024
+#define TP_DEFAULT_QUEUE_CAPACITY 65536
+
+// tasks handed to ring_enqueue_bulk() at once
+#define TP_BATCH_CHUNK 64
+
+// idle workers popped at once by _tp_notify_n()
+#define TP_WAKE_CHUNK 16
+
+// tasks a worker takes from its LIFO slot in a row before looking
+// at the queues, so a recursive workload can't starve them
+#define TP_LIFO_MAX_STREAK 3
+
+// cap of the pause loop between two polls of an idle worker,
+// sched_yield() is called instead once it's reached
+#define TP_SPIN_MAX_BACKOFF 64
+
+// spin iterations before blocking on a future
+#define TP_FUTURE_SPIN 200
+
+// default number of priority classes and aging threshold
+#define TP_DEFAULT_NPRIORITY 3
+#define TP_DEFAULT_PRIORITY_AGING 16
+
+// defaults of elastic mode
+#define TP_DEFAULT_SPAWN_LATENCY_US 1000
+#define TP_DEFAULT_KEEP_ALIVE_MS 60000
+
+// events kept by each thread while tracing
+#define TP_DEFAULT_TRACE_EVENTS 8192
+
+// chunk size of the workers' scratch arenas
+#define TP_DEFAULT_ARENA_SIZE (64 * 1024)
+
+// attempts of TP_OVERFLOW_DROP_OLDEST before giving up
+#define TP_DROP_TRIES 8
+
+// due timers moved to the task queues at once
+#define TP_TIMER_CHUNK 64
+
+// how often a helping tp_group_wait() looks for new tasks
+#define TP_GROUP_HELP_POLL_NS 1000000
+
+// pieces per thread a range is cut into when no grain is given
+#define TP_PARALLEL_PIECES 8
 
+// number of tasks per slab
+#define TP_SLAB_TASKS 64
+// maximum number of tasks in a worker's private cache
+#define TP_TASK_CACHE_MAX 256
+// number of tasks moved between a private cache and the shared list at once
+#define TP_TASK_CACHE_BATCH 32
 
+
+// A tp_parallel_for() or tp_parallel_reduce() call, on the caller's stack
 typedef struct
 {
     thread_pool_t *tp;
-} tp_self_arg;
+    tp_group_t group;
+    uint64_t grain;
+    void *ctx;
+    // set for tp_parallel_for()
+    tp_range_fn_t fn;
+    // set for tp_parallel_reduce(), pieces are combined into `result`
+    // under `lock` as they finish
+    tp_reduce_fn_t map;
+    tp_combine_fn_t combine;
+    const void *identity;
+    size_t size;
+    void *result;
+    pthread_spinlock_t lock;
+} tp_range_job_t;
+
+
+// Args of the task running a piece split off a range
+typedef struct
+{
+    tp_range_job_t *job;
+    uint64_t begin;
+    uint64_t end;
+} tp_range_piece_t;
 
 
-void _tp_self_key_init(thread_pool_t *tp);
+struct tp_slab_s
+{
+    tp_slab_t *next;
+    tp_task_t tasks[TP_SLAB_TASKS];
+};
 
-void _tp_self_destroy(thread_pool_t *tp);
 
 void *tp_worker(void *args);
 
@@ -22,21 +111,120 @@ void tp_cleanup_unlock(void *args);
 
 void tp_cleanup(void *args);
 
+void _tp_slab_destroy(thread_pool_t *tp);
+
+void _tp_wake_all(thread_pool_t *tp);
+
+void _tp_wake_n(thread_pool_t *tp, uint32_t n);
+
+void _tp_task_cache_flush(thread_pool_t *tp, tp_worker_t *worker);
+
+void _tp_future_complete(tp_future_t *future, tp_future_state_t state, void *result);
+
+void _tp_run_task(thread_pool_t *pool, tp_task_t *task);
+
+void _tp_task_done(thread_pool_t *pool);
+
+bool _tp_deps_hold(thread_pool_t *tp, tp_task_t *task);
+
+tp_task_t *_tp_deps_done(thread_pool_t *pool, tp_task_t *task);
+
+void _tp_deps_cancel(tp_task_t *task);
+
+void _tp_handoff(tp_task_t *task);
+
+tp_task_t *_tp_lane_pop(thread_pool_t *tp, tp_lane_t *lane);
+
+void _tp_release(thread_pool_t *tp, uint32_t n);
 
-static thread_local_t g_self_tls;
-static bool g_self_key_inited = false;
+bool _tp_timer_add(thread_pool_t *tp, tp_task_t *task, uint64_t due_ns, bool notify);
+
+bool _tp_timer_resched(thread_pool_t *pool, tp_task_t *task);
+
+void _tp_timer_poll(thread_pool_t *pool);
+
+uint64_t _tp_timer_arm(thread_pool_t *pool);
+
+bool _tp_timer_disarm(thread_pool_t *pool, uint64_t deadline);
+
+void _tp_timer_destroy(thread_pool_t *tp);
+
+
+// Whether a task has to wait for its predecessors when it's posted
+#define _tp_deps_pending(task) \
+(__atomic_load_n(&(task)->deps, __ATOMIC_RELAXED) > 1 \
+    || __atomic_load_n(&(task)->dep_cancelled, __ATOMIC_RELAXED))
+
+// The worker running on current thread, NULL if it's not a pool thread
+static TP_TLS tp_worker_t *g_worker = NULL;
+
+// The pool last initialized on current thread, what tp_self() returns
+// outside of the workers
+static TP_TLS thread_pool_t *g_self = NULL;
+
+// The task whose runner current thread is in, NULL outside of them
+static TP_TLS tp_task_t *g_task = NULL;
+
+// Metrics stripe of current thread, UINT32_MAX until it's picked
+static TP_TLS uint32_t g_stripe = UINT32_MAX;
+
+uint32_t _tp_stripe(void);
+
+/**
+ * Add `n` to a counter of the calling thread: its own shard if it's
+ * a worker of the pool, otherwise one of the shared stripes.
+ */
+#define _tp_metric_add(tp, field, n) \
+do { \
+    if (g_worker && g_worker->pool == (tp)) { \
+        g_worker->metrics.field += (n); \
+    } else { \
+        __sync_add_and_fetch(&(tp)->stripes[_tp_stripe()].field, (n)); \
+    } \
+} while (0)
 
 
 /* ---------------- Thread Pool API ---------------- */
 
 
+void tp_attr_init(tp_attr_t *attr)
+{
+    if (attr) {
+        bzero(attr, sizeof(tp_attr_t));
+
+        attr->sched = TP_SCHED_SHARED;
+        attr->deque_capacity = TP_DEFAULT_DEQUE_CAPACITY;
+        attr->queue_kind = TP_QUEUE_LIST;
+        attr->queue_capacity = TP_DEFAULT_QUEUE_CAPACITY;
+        attr->spin_us = 0;
+        attr->spin_adaptive = false;
+        attr->npriority = TP_DEFAULT_NPRIORITY;
+        attr->priority_aging = TP_DEFAULT_PRIORITY_AGING;
+        attr->max_threads = 0;
+        attr->spawn_latency_us = TP_DEFAULT_SPAWN_LATENCY_US;
+        attr->keep_alive_ms = TP_DEFAULT_KEEP_ALIVE_MS;
+        attr->max_queued = 0;
+        attr->overflow = TP_OVERFLOW_FAIL;
+        attr->overflow_timeout_us = TP_TIMEOUT_INFINITE;
+        attr->metrics = false;
+        attr->trace_events = TP_DEFAULT_TRACE_EVENTS;
+        attr->lifo_slot = false;
+        attr->arena_size = TP_DEFAULT_ARENA_SIZE;
+        attr->arena_keep = false;
+    }
+}
+
+
 bool _tp_init_pthread_vars(thread_pool_t *tp)
 {
     bool status = false;
 
     bool lock_inited = false;
-    bool cond_inited = false;
+    bool idle_lock_inited = false;
     bool no_task_inited = false;
+    bool slab_lock_inited = false;
+    bool timer_lock_inited = false;
+    bool resize_lock_inited = false;
 
     if (pthread_mutex_init(&tp->lock, NULL)) {
         perror("pthread_mutex_init() for `lock` failed");
@@ -45,12 +233,12 @@ bool _tp_init_pthread_vars(thread_pool_t *tp)
 
     lock_inited = true;
 
-    if (pthread_cond_init(&tp->has_task, NULL)) {
-        perror("pthread_cond_init() for `has_task` failed");
+    if (pthread_spin_init(&tp->idle_lock, PTHREAD_PROCESS_PRIVATE)) {
+        perror("pthread_spin_init() for `idle_lock` failed");
         goto EXIT;
     }
 
-    cond_inited = true;
+    idle_lock_inited = true;
 
     if (pthread_cond_init(&tp->no_task, NULL)) {
         perror("pthread_cond_init() for `no_task` failed");
@@ -59,19 +247,58 @@ bool _tp_init_pthread_vars(thread_pool_t *tp)
 
     no_task_inited = true;
 
+    if (pthread_mutex_init(&tp->slab_lock, NULL)) {
+        perror("pthread_mutex_init() for `slab_lock` failed");
+        goto EXIT;
+    }
+
+    slab_lock_inited = true;
+
+    if (pthread_mutex_init(&tp->timer_lock, NULL)) {
+        perror("pthread_mutex_init() for `timer_lock` failed");
+        goto EXIT;
+    }
+
+    timer_lock_inited = true;
+
+    if (pthread_mutex_init(&tp->resize_lock, NULL)) {
+        perror("pthread_mutex_init() for `resize_lock` failed");
+        goto EXIT;
+    }
+
+    resize_lock_inited = true;
+
     status = true;
 
 EXIT:
     if (!status) {
+        if (resize_lock_inited) {
+            if (pthread_mutex_destroy(&tp->resize_lock)) {
+                perror("pthread_mutex_destroy() for `resize_lock` failed");
+            }
+        }
+
+        if (timer_lock_inited) {
+            if (pthread_mutex_destroy(&tp->timer_lock)) {
+                perror("pthread_mutex_destroy() for `timer_lock` failed");
+            }
+        }
+
+        if (slab_lock_inited) {
+            if (pthread_mutex_destroy(&tp->slab_lock)) {
+                perror("pthread_mutex_destroy() for `slab_lock` failed");
+            }
+        }
+
         if (no_task_inited) {
             if (pthread_cond_destroy(&tp->no_task)) {
                 perror("pthread_cond_destroy() for `no_task` failed");
             }
         }
 
-        if (cond_inited) {
-            if (pthread_cond_destroy(&tp->has_task)) {
-                perror("pthread_cond_destroy() for `has_task` failed");
+        if (idle_lock_inited) {
+            if (pthread_spin_destroy(&tp->idle_lock)) {
+                perror("pthread_spin_destroy() for `idle_lock` failed");
             }
         }
 
@@ -85,27 +312,293 @@ EXIT:
 }
 
 
+void _tp_destroy_nodes(thread_pool_t *tp)
+{
+    free(tp->free_tasks);
+    tp->free_tasks = NULL;
+
+    if (tp->topo) {
+        tp_topo_destroy(tp->topo);
+        free(tp->topo);
+        tp->topo = NULL;
+    }
+}
+
+
+/**
+ * Load the topology if the workers are placed on CPUs or nodes,
+ * and allocate the per-node free lists.
+ */
+bool _tp_init_nodes(thread_pool_t *tp)
+{
+    bool status = false;
+
+    tp->nnode = 1;
+
+    if (tp->attr.affinity != TP_AFFINITY_NONE || tp->attr.numa) {
+        tp->topo = malloc(sizeof(tp_topo_t));
+
+        if (tp->topo == NULL) {
+            perror("failed to allocate topology");
+            goto EXIT;
+        }
+
+        if (!tp_topo_load(tp->topo)) {
+            free(tp->topo);
+            tp->topo = NULL;
+            goto EXIT;
+        }
+
+        if (tp->attr.numa) {
+            tp->nnode = tp->topo->nnode;
+        }
+    }
+
+    tp->free_tasks = calloc(tp->nnode, sizeof(tp_task_t *));
+
+    if (tp->free_tasks == NULL) {
+        perror("failed to allocate free lists");
+        goto EXIT;
+    }
+
+    status = true;
+
+EXIT:
+    if (!status) {
+        _tp_destroy_nodes(tp);
+    }
+
+    return status;
+}
+
+
+/**
+ * CPUs the worker of `index` is bound to, and the node they belong to.
+ *
+ * @return true: succeed
+ *         false: the worker isn't bound
+ */
+bool _tp_worker_cpus(thread_pool_t *tp, uint32_t index, cpu_set_t *cpus, uint32_t *node)
+{
+    int cpu;
+    uint32_t n;
+
+    if (tp->topo == NULL) {
+        return false;
+    }
+
+    CPU_ZERO(cpus);
+
+    if (tp->attr.affinity == TP_AFFINITY_CPU) {
+        if (tp->attr.cpus && tp->attr.ncpus > 0) {
+            cpu = tp->attr.cpus[index % tp->attr.ncpus];
+        } else {
+            cpu = tp_topo_nth_cpu(&tp->topo->allowed, index);
+        }
+
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            return false;
+        }
+
+        CPU_SET(cpu, cpus);
+        n = tp_topo_node_of(tp->topo, cpu);
+    } else {
+        n = index % tp->topo->nnode;
+        *cpus = tp->topo->node_cpus[n];
+    }
+
+    if (node) {
+        *node = n;
+    }
+
+    return true;
+}
+
+
+void _tp_destroy_workers(thread_pool_t *tp, uint32_t nworker)
+{
+    uint32_t i;
+
+    free(tp->idle);
+    tp->idle = NULL;
+
+    if (tp->workers == NULL) {
+        return;
+    }
+
+    // Arenas are zeroed until initialized, freeing nothing then
+    for (i = 0; i < tp->nthread; ++i) {
+        arena_destroy(&tp->workers[i].arena);
+    }
+
+    if (tp->attr.sched == TP_SCHED_STEALING) {
+        for (i = 0; i < nworker; ++i) {
+            deque_destroy(&tp->workers[i].deque);
+        }
+    }
+
+    free(tp->workers);
+    tp->workers = NULL;
+}
+
+
+bool _tp_init_workers(thread_pool_t *tp)
+{
+    bool status = false;
+    uint32_t i = 0;
+    cpu_set_t cpus;
+
+    tp->workers = calloc(tp->nthread, sizeof(tp_worker_t));
+    tp->idle = calloc(tp->nthread, sizeof(tp_worker_t *));
+
+    if (tp->workers == NULL || tp->idle == NULL) {
+        perror("failed to allocate workers");
+        goto EXIT;
+    }
+
+    for (i = 0; i < tp->nthread; ++i) {
+        tp->workers[i].pool = tp;
+        tp->workers[i].index = i;
+        tp->workers[i].seed = i * 2654435761u + 1;
+        hist_init(&tp->workers[i].metrics.wait_ns);
+        hist_init(&tp->workers[i].metrics.run_ns);
+
+        if (!arena_init(&tp->workers[i].arena, tp->attr.arena_size)) {
+            perror("failed to initialize arena");
+            goto EXIT;
+        }
+
+        if (tp->attr.numa) {
+            _tp_worker_cpus(tp, i, &cpus, &tp->workers[i].node);
+        }
+
+        if (tp->attr.sched == TP_SCHED_STEALING) {
+            if (!deque_init(&tp->workers[i].deque, tp->attr.deque_capacity)) {
+                perror("failed to allocate deque");
+                goto EXIT;
+            }
+        }
+    }
+
+    status = true;
+
+EXIT:
+    if (!status) {
+        _tp_destroy_workers(tp, i);
+    }
+
+    return status;
+}
+
+
+void _tp_destroy_lanes(thread_pool_t *tp, uint32_t nlane)
+{
+    uint32_t i;
+
+    if (tp->lanes == NULL) {
+        return;
+    }
+
+    for (i = 0; i < nlane; ++i) {
+        queue_clear(&tp->lanes[i].queue);
+
+        if (tp->attr.queue_kind == TP_QUEUE_RING) {
+            ring_destroy(&tp->lanes[i].ring);
+        }
+    }
+
+    free(tp->lanes);
+    tp->lanes = NULL;
+}
+
+
+bool _tp_init_lanes(thread_pool_t *tp)
+{
+    bool status = false;
+    uint32_t i = 0;
+
+    tp->nlane = tp->attr.npriority > 0 ? tp->attr.npriority : 1;
+    tp->lanes = calloc(tp->nnode * tp->nlane, sizeof(tp_lane_t));
+
+    if (tp->lanes == NULL) {
+        perror("failed to allocate task queues");
+        goto EXIT;
+    }
+
+    for (i = 0; i < tp->nnode * tp->nlane; ++i) {
+        queue_init(&tp->lanes[i].queue);
+
+        if (tp->attr.queue_kind == TP_QUEUE_RING) {
+            if (!ring_init(&tp->lanes[i].ring, tp->attr.queue_capacity)) {
+                perror("failed to allocate task ring");
+                goto EXIT;
+            }
+        }
+    }
+
+    status = true;
+
+EXIT:
+    if (!status) {
+        _tp_destroy_lanes(tp, i);
+    }
+
+    return status;
+}
+
+
 bool tp_init(thread_pool_t *tp, uint32_t nthreads)
+{
+    return tp_init_attr(tp, nthreads, NULL);
+}
+
+
+bool tp_init_attr(thread_pool_t *tp, uint32_t nthreads, const tp_attr_t *attr)
 {
     bool status = false;
-    bool queue_inited = false;
+    bool nodes_inited = false;
+    bool lanes_inited = false;
     bool threads_allocated = false;
+    bool workers_inited = false;
 
     bzero(tp, sizeof(thread_pool_t));
 
-    tp->nthread = nthreads;
+    if (attr) {
+        tp->attr = *attr;
+    } else {
+        tp_attr_init(&tp->attr);
+    }
+
+    // One slot for each thread the pool may grow to
+    tp->nthread = nthreads > tp->attr.max_threads ? nthreads : tp->attr.max_threads;
+    tp->min_threads = nthreads;
+    tp->max_threads = tp->nthread;
+
+    if (tp->nthread == 0) {
+        goto EXIT;
+    }
+
+    heap_init(&tp->timers, 0);
+    tp->timer_next_ns = TP_SYNC_INFINITE;
+    tp->timer_armed_ns = TP_SYNC_INFINITE;
+
+    if (!_tp_init_nodes(tp)) {
+        goto EXIT;
+    }
+
+    nodes_inited = true;
 
-    if (!queue_init(&tp->task_queue)) {
+    if (!_tp_init_lanes(tp)) {
         goto EXIT;
     }
 
-    queue_inited = true;
+    lanes_inited = true;
 
     if (!_tp_init_pthread_vars(tp)) {
         goto EXIT;
     }
 
-    tp->threads = calloc(nthreads, sizeof(pthread_t));
+    tp->threads = calloc(tp->nthread, sizeof(pthread_t));
 
     if (tp->threads == NULL) {
         perror("failed to allocate threads");
@@ -114,18 +607,32 @@ bool tp_init(thread_pool_t *tp, uint32_t nthreads)
 
     threads_allocated = true;
 
-    _tp_self_key_init(tp);
+    if (!_tp_init_workers(tp)) {
+        goto EXIT;
+    }
+
+    workers_inited = true;
+
+    g_self = tp;
 
     status = true;
 
 EXIT:
     if (!status) {
+        if (workers_inited) {
+            _tp_destroy_workers(tp, tp->nthread);
+        }
+
         if (threads_allocated) {
             free(tp->threads);
         }
 
-        if (queue_inited) {
-            queue_clear(&tp->task_queue);
+        if (lanes_inited) {
+            _tp_destroy_lanes(tp, tp->nnode * tp->nlane);
+        }
+
+        if (nodes_inited) {
+            _tp_destroy_nodes(tp);
         }
 
         bzero(tp, sizeof(thread_pool_t));
@@ -135,37 +642,90 @@ EXIT:
 }
 
 
+/**
+ * Create the thread of a worker, bound to its CPUs if it's placed.
+ */
+bool _tp_create_worker(thread_pool_t *tp, uint32_t index)
+{
+    bool status = false;
+    bool attr_inited = false;
+    cpu_set_t cpus;
+    pthread_attr_t attr;
+    pthread_attr_t *pattr = NULL;
+
+    // Set it before the thread starts, so even its stack is node-local
+    if (_tp_worker_cpus(tp, index, &cpus, NULL)) {
+        if (pthread_attr_init(&attr)) {
+            perror("pthread_attr_init() failed");
+            goto EXIT;
+        }
+
+        attr_inited = true;
+
+        if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus)) {
+            perror("pthread_attr_setaffinity_np() failed");
+            goto EXIT;
+        }
+
+        pattr = &attr;
+    }
+
+    if (pthread_create(&tp->threads[index], pattr, tp_worker, &tp->workers[index])) {
+        perror("pthread_create() failed");
+        goto EXIT;
+    }
+
+    status = true;
+
+EXIT:
+    if (attr_inited) {
+        pthread_attr_destroy(&attr);
+    }
+
+    return status;
+}
+
+
 bool tp_start(thread_pool_t *tp)
 {
     int i;
     bool status = false;
     int threads_created_num = 0;
 
-    if (tp == NULL || tp->threads == NULL) {
-        goto EXIT;
+    // Not initialized, or already started: the running workers are left alone
+    if (tp == NULL || tp->threads == NULL || tp->nlive > 0) {
+        return false;
     }
 
-    for (i = 0; i < (int) tp->nthread; ++i) {
-        if (pthread_create(&tp->threads[i], NULL, tp_worker, tp)) {
+    tp->stopping = 0;
+    tp->drain = TP_DRAIN_QUEUED;
+    tp->last_take_ns = tp_now_ns();
+
+    for (i = 0; i < (int) tp->min_threads; ++i) {
+        tp->workers[i].slot = TP_SLOT_LIVE;
+
+        if (!_tp_create_worker(tp, (uint32_t) i)) {
+            tp->workers[i].slot = TP_SLOT_FREE;
             threads_created_num = i;
             goto EXIT;
         }
     }
 
+    tp->nlive = tp->min_threads;
     status = true;
 
 EXIT:
-    if (!status) {
-        for (i = 0; i < threads_created_num; ++i) {
-            if (pthread_cancel(tp->threads[i])) {
-                perror("pthread_cancel() failed");
-            }
-        }
+    if (!status && threads_created_num > 0) {
+        // There is no task yet, they exit once woken up
+        __atomic_store_n(&tp->stopping, 1, __ATOMIC_SEQ_CST);
+        _tp_wake_all(tp);
 
         for (i = 0; i < threads_created_num; ++i) {
             if (pthread_join(tp->threads[i], NULL)) {
                 perror("pthread_join() failed");
             }
+
+            tp->workers[i].slot = TP_SLOT_FREE;
         }
     }
 
@@ -173,99 +733,2601 @@ EXIT:
 }
 
 
-void tp_destroy(thread_pool_t *tp)
+/**
+ * Free a task which won't run.
+ */
+void _tp_discard_task(tp_task_t *task, bool cleanup)
 {
-    int i;
+    if (task->cleanup && cleanup) {
+        task->cleanup(task->args);
+    }
+
+    tp_task_free(task);
+}
+
+
+/**
+ * Discard the tasks left in the queues, the deques and the timers.
+ * Only called once the workers exited.
+ */
+void _tp_discard_queued(thread_pool_t *tp)
+{
+    uint32_t i;
+    qdata_t data;
+    heap_node_t node;
+    tp_task_t *task;
+    bool cleanup = tp->drain != TP_DRAIN_RUNNING;
+
+    for (i = 0; i < tp->nnode * tp->nlane; ++i) {
+        while ((task = _tp_lane_pop(tp, &tp->lanes[i])) != NULL) {
+            _tp_release(tp, 1);
+            _tp_discard_task(task, cleanup);
+            _tp_task_done(tp);
+        }
+    }
+
+    if (tp->attr.sched == TP_SCHED_STEALING) {
+        for (i = 0; i < tp->nthread; ++i) {
+            while (deque_pop(&tp->workers[i].deque, &data)) {
+                _tp_discard_task(data.ptr, cleanup);
+                _tp_task_done(tp);
+            }
+        }
+    }
+
+    for (i = 0; i < tp->nthread; ++i) {
+        if ((task = tp->workers[i].lifo) != NULL) {
+            tp->workers[i].lifo = NULL;
+            _tp_discard_task(task, cleanup);
+            _tp_task_done(tp);
+        }
+    }
+
+    // Timers aren't counted as active until they're due
+    pthread_mutex_lock(&tp->timer_lock);
+
+    while (heap_pop(&tp->timers, &node)) {
+        _tp_discard_task(node.data.ptr, cleanup);
+    }
+
+    tp->timer_next_ns = TP_SYNC_INFINITE;
+    tp->timer_armed_ns = TP_SYNC_INFINITE;
+
+    pthread_mutex_unlock(&tp->timer_lock);
+}
+
+
+bool tp_shutdown(thread_pool_t *tp, tp_drain_t drain, uint64_t timeout_us)
+{
+    int i;
+    int err;
+    bool status = false;
+    uint64_t deadline;
+    struct timespec ts;
+
+    if (tp == NULL || tp->threads == NULL) {
+        goto EXIT;
+    }
+
+    if (timeout_us != TP_TIMEOUT_INFINITE) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        deadline = (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec + timeout_us * 1000;
+        ts.tv_sec = (time_t) (deadline / 1000000000);
+        ts.tv_nsec = (long) (deadline % 1000000000);
+    }
+
+    // No worker is spawned or retires from now on. Calling it again
+    // may give up more tasks, but never resumes the discarded ones.
+    pthread_mutex_lock(&tp->resize_lock);
+
+    if (!tp->stopping || drain > tp->drain) {
+        __atomic_store_n(&tp->drain, drain, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&tp->stopping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&tp->resize_lock);
+
+    // Parked workers see the flag once woken up, busy ones after their task,
+    // and producers waiting for room give up
+    _tp_wake_all(tp);
+    __atomic_add_fetch(&tp->room_seq, 1, __ATOMIC_SEQ_CST);
+    tp_sync_wake_all(&tp->room_seq);
+
+    for (i = 0; i < (int) tp->nthread; ++i) {
+        if (tp->workers[i].slot == TP_SLOT_FREE) {
+            continue;
+        }
+
+        if (timeout_us == TP_TIMEOUT_INFINITE) {
+            err = pthread_join(tp->threads[i], NULL);
+        } else {
+            err = pthread_timedjoin_np(tp->threads[i], NULL, &ts);
+        }
+
+        if (err == ETIMEDOUT) {
+            // Give up the queued tasks, the running ones can't be stopped
+            if (tp->drain == TP_DRAIN_QUEUED) {
+                __atomic_store_n(&tp->drain, TP_DRAIN_DISCARD, __ATOMIC_RELAXED);
+            }
+
+            goto EXIT;
+        }
+
+        if (err) {
+            errno = err;
+            perror("pthread_join() failed");
+        }
+
+        tp->workers[i].slot = TP_SLOT_FREE;
+    }
+
+    // Workers seeing the flag while parking left themselves in the stack
+    for (i = 0; i < (int) tp->nthread; ++i) {
+        tp->workers[i].park = TP_WORKER_RUNNING;
+        tp->workers[i].in_idle = false;
+    }
+
+    tp->nidle = 0;
+    tp->nlive = 0;
+    _tp_discard_queued(tp);
+    status = true;
+
+EXIT:
+    return status;
+}
 
+
+void tp_destroy(thread_pool_t *tp)
+{
     if (tp == NULL) {
         return;
     }
 
     if (tp->threads) {
+        tp_shutdown(tp, tp->stopping ? tp->drain : TP_DRAIN_DISCARD, TP_TIMEOUT_INFINITE);
+
+        free(tp->threads);
+    }
+
+    tp_trace_destroy(tp);
+    _tp_destroy_workers(tp, tp->nthread);
+
+    if (pthread_spin_destroy(&tp->idle_lock)) {
+        perror("pthread_spin_destroy() failed");
+    }
+
+    if (pthread_mutex_destroy(&tp->lock)) {
+        perror("pthread_mutex_destroy()");
+    }
+
+    _tp_timer_destroy(tp);
+
+    if (pthread_mutex_destroy(&tp->timer_lock)) {
+        perror("pthread_mutex_destroy()");
+    }
+
+    if (pthread_mutex_destroy(&tp->resize_lock)) {
+        perror("pthread_mutex_destroy()");
+    }
+
+    _tp_slab_destroy(tp);
+
+    if (pthread_mutex_destroy(&tp->slab_lock)) {
+        perror("pthread_mutex_destroy()");
+    }
+
+    if (g_self == tp) {
+        g_self = NULL;
+    }
+
+    _tp_destroy_lanes(tp, tp->nnode * tp->nlane);
+    _tp_destroy_nodes(tp);
+
+    bzero(tp, sizeof(thread_pool_t));
+}
+
+
+void tp_join(thread_pool_t *tp)
+{
+    int i;
+
+    if (tp && tp->threads) {
         for (i = 0; i < (int) tp->nthread; ++i) {
+            if (tp->workers[i].slot == TP_SLOT_FREE) {
+                continue;
+            }
+
             // todo: check return value
-            if (pthread_cancel(tp->threads[i])) {
-                perror("pthread_cancel() failed");
+            if (pthread_join(tp->threads[i], NULL)) {
+                perror("pthread_join() failed");
             }
+
+            tp->workers[i].slot = TP_SLOT_FREE;
         }
+    }
+}
 
-        tp_join(tp);
 
-        free(tp->threads);
+bool tp_join_tasks(thread_pool_t *tp)
+{
+    pthread_mutex_lock(&tp->lock);
+
+    while (tp->active_tasks > 0) {
+        pthread_cond_wait(&tp->no_task, &tp->lock);
+    }
+
+    pthread_mutex_unlock(&tp->lock);
+
+    return tp->active_tasks == 0;
+}
+
+
+/* ---------------- Elastic API ---------------- */
+
+
+#define _tp_elastic(tp) \
+(__atomic_load_n(&(tp)->max_threads, __ATOMIC_RELAXED) \
+    > __atomic_load_n(&(tp)->min_threads, __ATOMIC_RELAXED))
+
+#define _tp_over_max(tp) \
+(__atomic_load_n(&(tp)->nlive, __ATOMIC_RELAXED) \
+    > __atomic_load_n(&(tp)->max_threads, __ATOMIC_RELAXED))
+
+
+/**
+ * Start a worker in a free slot, unless the pool is at its maximum.
+ */
+bool _tp_spawn(thread_pool_t *tp)
+{
+    bool status = false;
+    uint32_t i;
+    tp_worker_t *worker;
+
+    pthread_mutex_lock(&tp->resize_lock);
+
+    if (tp->stopping || tp->nlive >= tp->max_threads) {
+        goto UNLOCK;
+    }
+
+    for (i = 0; i < tp->nthread; ++i) {
+        if (tp->workers[i].slot != TP_SLOT_LIVE) {
+            break;
+        }
+    }
+
+    if (i == tp->nthread) {
+        goto UNLOCK;
+    }
+
+    worker = &tp->workers[i];
+
+    if (worker->slot == TP_SLOT_EXITED) {
+        // It's out of its loop already, so it doesn't block for long
+        if (pthread_join(tp->threads[i], NULL)) {
+            perror("pthread_join() failed");
+        }
+    }
+
+    worker->park = TP_WORKER_RUNNING;
+    worker->in_idle = false;
+    worker->idle_ewma_ns = 0;
+    worker->prio_streak = 0;
+    worker->slot = TP_SLOT_LIVE;
+
+    if (!_tp_create_worker(tp, i)) {
+        worker->slot = TP_SLOT_FREE;
+        goto UNLOCK;
+    }
+
+    __atomic_store_n(&tp->nlive, tp->nlive + 1, __ATOMIC_RELAXED);
+    ++tp->spawned;
+    status = true;
+
+UNLOCK:
+    pthread_mutex_unlock(&tp->resize_lock);
+
+    return status;
+}
+
+
+/**
+ * Let the calling worker leave the pool if there are more than `limit`
+ * workers. It must not be in the idle stack, and its deque and slot
+ * must be empty since only the live workers steal from them.
+ */
+bool _tp_retire(thread_pool_t *pool, tp_worker_t *self, uint32_t limit)
+{
+    bool status = false;
+
+    if (pool->attr.sched == TP_SCHED_STEALING && !deque_isempty(&self->deque)) {
+        goto EXIT;
+    }
+
+    if (__atomic_load_n(&self->lifo, __ATOMIC_ACQUIRE)) {
+        goto EXIT;
+    }
+
+    pthread_mutex_lock(&pool->resize_lock);
+
+    if (!pool->stopping && pool->nlive > limit) {
+        __atomic_store_n(&pool->nlive, pool->nlive - 1, __ATOMIC_SEQ_CST);
+
+        // Pairs with _tp_notify_n(): either a poster sees no worker
+        // and spawns one, or the last worker sees its task and stays,
+        // so does it for the pending timers
+        if (pool->nlive == 0
+            && (tp_queue_len(pool) > 0 || __atomic_load_n(&pool->timers.len, __ATOMIC_RELAXED) > 0)) {
+            __atomic_store_n(&pool->nlive, 1, __ATOMIC_RELAXED);
+        } else {
+            self->slot = TP_SLOT_EXITED;
+            ++pool->retired;
+            status = true;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->resize_lock);
+
+    if (status) {
+        _tp_task_cache_flush(pool, self);
+
+        // It may have been woken up for a task, hand it over to another
+        // idle worker. No spawning here, it could pick our own slot.
+        __sync_synchronize();
+        _tp_wake_n(pool, 1);
+    }
+
+EXIT:
+    return status;
+}
+
+
+/**
+ * Start a worker when nobody is idle and tasks waited `waited_ns`,
+ * longer than the pool tolerates. Elastic mode only.
+ */
+void _tp_maybe_grow(thread_pool_t *tp, uint64_t waited_ns)
+{
+    uint32_t nlive = __atomic_load_n(&tp->nlive, __ATOMIC_RELAXED);
+
+    if (nlive >= __atomic_load_n(&tp->max_threads, __ATOMIC_RELAXED)
+        || __atomic_load_n(&tp->nidle, __ATOMIC_RELAXED) > 0) {
+        return;
+    }
+
+    if (nlive == 0 || waited_ns > (uint64_t) tp->attr.spawn_latency_us * 1000) {
+        _tp_spawn(tp);
+    }
+}
+
+
+/**
+ * Account a task taken by a worker: record how long it waited,
+ * and grow the pool if that was too long.
+ */
+void _tp_on_take(thread_pool_t *pool, tp_worker_t *self, tp_task_t *task)
+{
+    uint64_t now = tp_now_ns();
+    uint64_t waited = now > task->post_ns ? now - task->post_ns : 0;
+
+    if (pool->attr.metrics) {
+        hist_record(&self->metrics.wait_ns, waited);
+    }
+
+    if (_tp_elastic(pool)) {
+        __atomic_store_n(&pool->last_take_ns, now, __ATOMIC_RELAXED);
+
+        if (waited) {
+            _tp_maybe_grow(pool, waited);
+        }
     }
+}
+
+
+bool tp_resize(thread_pool_t *tp, uint32_t min_threads, uint32_t max_threads)
+{
+    bool status = false;
+
+    if (tp == NULL || min_threads > max_threads || max_threads == 0
+        || max_threads > tp->nthread) {
+        goto EXIT;
+    }
+
+    pthread_mutex_lock(&tp->resize_lock);
+    __atomic_store_n(&tp->min_threads, min_threads, __ATOMIC_RELAXED);
+    __atomic_store_n(&tp->max_threads, max_threads, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&tp->resize_lock);
+
+    while (__atomic_load_n(&tp->nlive, __ATOMIC_RELAXED) < min_threads) {
+        if (!_tp_spawn(tp)) {
+            goto EXIT;
+        }
+    }
+
+    // Idle workers above the maximum retire once woken up,
+    // busy ones after their current task
+    if (_tp_over_max(tp)) {
+        _tp_wake_all(tp);
+    }
+
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+/* ---------------- Task List ---------------- */
+
+
+void _tp_task_list_push(tp_task_list_t *list, tp_task_t *task)
+{
+    task->next = NULL;
+
+    if (list->tail) {
+        list->tail->next = task;
+    } else {
+        list->head = task;
+    }
+
+    list->tail = task;
+    ++list->len;
+}
+
+
+tp_task_t *_tp_task_list_pop(tp_task_list_t *list)
+{
+    tp_task_t *task = list->head;
+
+    if (task) {
+        list->head = task->next;
+
+        if (list->head == NULL) {
+            list->tail = NULL;
+        }
+
+        task->next = NULL;
+        --list->len;
+    }
+
+    return task;
+}
+
+
+// lane of a priority, the larger ones belong to the lowest class
+#define _tp_lane_of(tp, prio) ((prio) < (tp)->nlane ? (prio) : (tp)->nlane - 1)
+
+// lane of TP_PRIORITY_NORMAL, which the workers' deques stand for
+#define _tp_normal_lane(tp) _tp_lane_of((tp), TP_PRIORITY_NORMAL)
+
+// lanes of a node
+#define _tp_node_lanes(tp, node) (&(tp)->lanes[(node) * (tp)->nlane])
+
+
+/**
+ * Node of the CPU the calling thread is running on.
+ */
+uint32_t _tp_current_node(thread_pool_t *tp)
+{
+    if (tp->nnode == 1) {
+        return 0;
+    }
+
+    return tp_topo_node_of(tp->topo, sched_getcpu());
+}
+
+
+/**
+ * Lane a task is posted to: its class in the node it's meant for,
+ * or in the poster's node `home`.
+ */
+tp_lane_t *_tp_task_lane(thread_pool_t *tp, tp_task_t *task, uint32_t home)
+{
+    uint32_t node = task->node < tp->nnode ? task->node : home;
+
+    return &_tp_node_lanes(tp, node)[_tp_lane_of(tp, task->priority)];
+}
+
+
+/**
+ * Number of tasks in a lane, racy unless `lock` is held
+ * in the locked modes.
+ */
+uint32_t _tp_lane_len(thread_pool_t *tp, tp_lane_t *lane)
+{
+    switch (tp->attr.queue_kind) {
+        case TP_QUEUE_RING:
+            return ring_len(&lane->ring);
+        case TP_QUEUE_INTRUSIVE:
+            return __atomic_load_n(&lane->list.len, __ATOMIC_RELAXED);
+        default:
+            return __atomic_load_n(&lane->queue.len, __ATOMIC_RELAXED);
+    }
+}
 
-    if (pthread_cond_destroy(&tp->has_task)) {
-        perror("pthread_cond_destroy() failed");
+
+/**
+ * Record the depth of a lane after tasks were pushed to it.
+ */
+void _tp_lane_mark(thread_pool_t *tp, tp_lane_t *lane)
+{
+    uint32_t len = _tp_lane_len(tp, lane);
+    uint32_t high = __atomic_load_n(&lane->high_water, __ATOMIC_RELAXED);
+
+    while (len > high) {
+        if (__atomic_compare_exchange_n(&lane->high_water, &high, len, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+
+/**
+ * Push a task to a lane.
+ * `lock` must be held in the locked modes.
+ */
+bool _tp_lane_push(thread_pool_t *tp, tp_lane_t *lane, tp_task_t *task)
+{
+    bool status;
+    qdata_t data;
+
+    data.ptr = task;
+
+    switch (tp->attr.queue_kind) {
+        case TP_QUEUE_RING:
+            status = ring_enqueue(&lane->ring, data);
+            break;
+        case TP_QUEUE_INTRUSIVE:
+            _tp_task_list_push(&lane->list, task);
+            status = true;
+            break;
+        default:
+            status = queue_enqueue(&lane->queue, data);
+            break;
+    }
+
+    if (status) {
+        _tp_lane_mark(tp, lane);
+    }
+
+    return status;
+}
+
+
+/**
+ * Pop a task from a lane.
+ * `lock` must be held in the locked modes.
+ */
+tp_task_t *_tp_lane_pop(thread_pool_t *tp, tp_lane_t *lane)
+{
+    qdata_t data;
+    bool popped;
+
+    switch (tp->attr.queue_kind) {
+        case TP_QUEUE_RING:
+            popped = ring_dequeue(&lane->ring, &data);
+            break;
+        case TP_QUEUE_INTRUSIVE:
+            return _tp_task_list_pop(&lane->list);
+        default:
+            popped = queue_dequeue(&lane->queue, &data);
+            break;
+    }
+
+    return popped ? data.ptr : NULL;
+}
+
+
+/**
+ * Take a task from a lane, locking it only when it looks non-empty.
+ */
+tp_task_t *_tp_lane_take(thread_pool_t *tp, tp_lane_t *lane)
+{
+    tp_task_t *task = NULL;
+
+    if (tp->attr.queue_kind == TP_QUEUE_RING) {
+        task = _tp_lane_pop(tp, lane);
+    } else if (_tp_lane_len(tp, lane) > 0) {
+        // Racy peek to avoid taking the lock for nothing,
+        // _tp_park() checks it again after a barrier.
+        pthread_mutex_lock(&tp->lock);
+        task = _tp_lane_pop(tp, lane);
+        pthread_mutex_unlock(&tp->lock);
+    }
+
+    if (task) {
+        _tp_release(tp, 1);
+    }
+
+    return task;
+}
+
+
+uint32_t tp_queue_len(thread_pool_t *tp)
+{
+    uint32_t i;
+    uint32_t len = 0;
+
+    for (i = 0; i < tp->nnode * tp->nlane; ++i) {
+        len += _tp_lane_len(tp, &tp->lanes[i]);
+    }
+
+    return len;
+}
+
+
+void tp_priority_stats(thread_pool_t *tp, uint32_t priority, tp_priority_stats_t *stats)
+{
+    uint32_t i;
+    tp_lane_t *lane;
+
+    bzero(stats, sizeof(tp_priority_stats_t));
+
+    // Summed over the nodes
+    for (i = 0; i < tp->nnode; ++i) {
+        lane = &_tp_node_lanes(tp, i)[_tp_lane_of(tp, priority)];
+
+        stats->depth += _tp_lane_len(tp, lane);
+        stats->high_water += __atomic_load_n(&lane->high_water, __ATOMIC_RELAXED);
+        stats->aged += __atomic_load_n(&lane->aged, __ATOMIC_RELAXED);
+    }
+}
+
+
+/**
+ * Reserve room for at most `n` tasks in the shared queues,
+ * returning how many fit.
+ */
+uint32_t _tp_reserve(thread_pool_t *tp, uint32_t n)
+{
+    uint32_t k;
+    uint32_t queued;
+    uint32_t max = tp->attr.max_queued;
+
+    if (max == 0) {
+        return n;
+    }
+
+    queued = __atomic_load_n(&tp->nqueued, __ATOMIC_RELAXED);
+
+    do {
+        if (queued >= max) {
+            return 0;
+        }
+
+        k = max - queued < n ? max - queued : n;
+    } while (!__atomic_compare_exchange_n(&tp->nqueued, &queued, queued + k, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return k;
+}
+
+
+/**
+ * Give back the room of `n` tasks which left the shared queues,
+ * or weren't pushed, waking up the producers waiting for it.
+ */
+void _tp_release(thread_pool_t *tp, uint32_t n)
+{
+    if (tp->attr.max_queued) {
+        __sync_sub_and_fetch(&tp->nqueued, n);
+    }
+
+    // Pairs with _tp_wait_room(): either the producer sees the room,
+    // or we see it waiting. A ring may be full without a limit too.
+    if (__atomic_load_n(&tp->nblocked, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_add_fetch(&tp->room_seq, 1, __ATOMIC_SEQ_CST);
+        tp_sync_wake_all(&tp->room_seq);
+    }
+}
+
+
+void tp_overflow_stats(thread_pool_t *tp, tp_overflow_stats_t *stats)
+{
+    stats->blocked = __atomic_load_n(&tp->overflow_stats.blocked, __ATOMIC_RELAXED);
+    stats->timed_out = __atomic_load_n(&tp->overflow_stats.timed_out, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&tp->overflow_stats.rejected, __ATOMIC_RELAXED);
+    stats->caller_runs = __atomic_load_n(&tp->overflow_stats.caller_runs, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&tp->overflow_stats.dropped, __ATOMIC_RELAXED);
+}
+
+
+/* ---------------- Metrics API ---------------- */
+
+
+/**
+ * Stripe of the calling thread, picked round robin on its first use.
+ */
+uint32_t _tp_stripe(void)
+{
+    static uint32_t next = 0;
+
+    if (g_stripe == UINT32_MAX) {
+        g_stripe = __sync_fetch_and_add(&next, 1) % TP_METRICS_STRIPES;
+    }
+
+    return g_stripe;
+}
+
+
+void tp_metrics_snapshot(thread_pool_t *tp, tp_metrics_t *metrics)
+{
+    uint32_t i;
+    uint32_t high;
+    tp_worker_metrics_t *worker;
+    tp_metrics_stripe_t *stripe;
+
+    bzero(metrics, sizeof(tp_metrics_t));
+    hist_init(&metrics->wait_ns);
+    hist_init(&metrics->run_ns);
+
+    // The owners keep writing, a snapshot may miss their latest tasks
+    for (i = 0; i < tp->nthread; ++i) {
+        worker = &tp->workers[i].metrics;
+        metrics->posted += __atomic_load_n(&worker->posted, __ATOMIC_RELAXED);
+        metrics->completed += __atomic_load_n(&worker->completed, __ATOMIC_RELAXED);
+        metrics->stolen += __atomic_load_n(&worker->stolen, __ATOMIC_RELAXED);
+        metrics->rejected += __atomic_load_n(&worker->rejected, __ATOMIC_RELAXED);
+        hist_merge(&metrics->wait_ns, &worker->wait_ns);
+        hist_merge(&metrics->run_ns, &worker->run_ns);
+    }
+
+    for (i = 0; i < TP_METRICS_STRIPES; ++i) {
+        stripe = &tp->stripes[i];
+        metrics->posted += __atomic_load_n(&stripe->posted, __ATOMIC_RELAXED);
+        metrics->completed += __atomic_load_n(&stripe->completed, __ATOMIC_RELAXED);
+        metrics->stolen += __atomic_load_n(&stripe->stolen, __ATOMIC_RELAXED);
+        metrics->rejected += __atomic_load_n(&stripe->rejected, __ATOMIC_RELAXED);
+    }
+
+    // Deepest lane of any node
+    for (i = 0; i < tp->nnode * tp->nlane; ++i) {
+        high = __atomic_load_n(&tp->lanes[i].high_water, __ATOMIC_RELAXED);
+
+        if (high > metrics->queue_high_water) {
+            metrics->queue_high_water = high;
+        }
+    }
+
+    metrics->active_tasks = __atomic_load_n(&tp->active_tasks, __ATOMIC_RELAXED);
+    metrics->queue_depth = tp_queue_len(tp);
+    metrics->live_threads = tp_live_threads(tp);
+}
+
+
+bool tp_worker_metrics(thread_pool_t *tp, uint32_t index, tp_worker_metrics_t *metrics)
+{
+    bool status = false;
+
+    if (tp == NULL || metrics == NULL || index >= tp->nthread) {
+        goto EXIT;
+    }
+
+    memcpy(metrics, &tp->workers[index].metrics, sizeof(tp_worker_metrics_t));
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+/**
+ * Wake up the given idle workers, which were popped from the idle stack.
+ */
+void _tp_unpark(thread_pool_t *tp, tp_worker_t **workers, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; ++i) {
+        __atomic_store_n(&workers[i]->park, TP_WORKER_RUNNING, __ATOMIC_RELEASE);
+        tp_sync_wake(&workers[i]->park, 1);
+    }
+
+    __sync_add_and_fetch(&tp->wake_calls, n);
+}
+
+
+/**
+ * Wake up at most `n` idle workers if there is any.
+ * Must be called after the tasks were published.
+ */
+void _tp_notify_n(thread_pool_t *tp, uint32_t n)
+{
+    // Pairs with the barrier in _tp_park(): either we see the
+    // idle worker, or it sees the task we just published.
+    __sync_synchronize();
+
+    if (__atomic_load_n(&tp->nidle, __ATOMIC_RELAXED) == 0) {
+        // Everyone is running, they'll find the task by themselves,
+        // unless none of them took a task for too long
+        __sync_add_and_fetch(&tp->wake_skipped, 1);
+
+        if (_tp_elastic(tp) && !tp->stopping) {
+            _tp_maybe_grow(tp, tp_now_ns() - __atomic_load_n(&tp->last_take_ns, __ATOMIC_RELAXED));
+        }
+
+        return;
+    }
+
+    _tp_wake_n(tp, n);
+}
+
+
+/**
+ * Take at most `n` workers out of the idle stack and wake them up.
+ */
+void _tp_wake_n(thread_pool_t *tp, uint32_t n)
+{
+    uint32_t k = 0;
+    tp_worker_t *woken[TP_WAKE_CHUNK];
+
+    while (n > 0) {
+        pthread_spin_lock(&tp->idle_lock);
+
+        // The most recently parked ones first, their caches are warmer
+        for (k = 0; k < n && k < TP_WAKE_CHUNK && tp->nidle > 0; ++k) {
+            woken[k] = tp->idle[--tp->nidle];
+            woken[k]->in_idle = false;
+        }
+
+        pthread_spin_unlock(&tp->idle_lock);
+
+        if (k == 0) {
+            break;
+        }
+
+        _tp_unpark(tp, woken, k);
+        n -= k;
+    }
+}
+
+
+#define _tp_notify(tp) _tp_notify_n((tp), 1)
+
+
+void _tp_wake_all(thread_pool_t *tp)
+{
+    _tp_notify_n(tp, tp->nthread);
+}
+
+
+/**
+ * Put a task posted by a worker into its LIFO slot if it's empty.
+ */
+bool _tp_lifo_put(thread_pool_t *tp, tp_worker_t *self, tp_task_t *task)
+{
+    tp_task_t *empty = NULL;
+
+    if (!tp->attr.lifo_slot) {
+        return false;
+    }
+
+    // Only the owner fills it, thieves just empty it
+    return __atomic_compare_exchange_n(&self->lifo, &empty, task, false,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Take the task in the LIFO slot of another worker.
+ */
+tp_task_t *_tp_lifo_steal(tp_worker_t *victim)
+{
+    tp_task_t *task = __atomic_load_n(&victim->lifo, __ATOMIC_RELAXED);
+
+    // Whatever replaced it meanwhile is a task posted to the slot as well
+    while (task && !__atomic_compare_exchange_n(&victim->lifo, &task, NULL, true,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {}
+
+    return task;
+}
+
+
+bool _tp_enqueue(thread_pool_t *tp, tp_task_t *task)
+{
+    bool status = false;
+    qdata_t data;
+    tp_worker_t *self = g_worker;
+    tp_lane_t *lane;
+
+    if (self && self->pool != tp) {
+        self = NULL;
+    }
+
+    lane = _tp_task_lane(tp, task, self ? self->node : _tp_current_node(tp));
+    data.ptr = task;
+
+    if (tp->attr.metrics || _tp_elastic(tp)) {
+        task->post_ns = tp_now_ns();
+    }
+
+    if (self && lane == &_tp_node_lanes(tp, self->node)[_tp_normal_lane(tp)]) {
+        if (_tp_lifo_put(tp, self, task)) {
+            _tp_notify(tp);
+            status = true;
+            goto EXIT;
+        }
+    }
+
+    if (tp->attr.sched == TP_SCHED_STEALING && self
+        && lane == &_tp_node_lanes(tp, self->node)[_tp_normal_lane(tp)]) {
+        if (deque_push(&self->deque, data)) {
+            _tp_notify(tp);
+            status = true;
+            goto EXIT;
+        }
+    }
+
+    if (!_tp_reserve(tp, 1)) {
+        goto EXIT;
+    }
+
+    if (tp->attr.queue_kind == TP_QUEUE_RING) {
+        status = _tp_lane_push(tp, lane, task);
+    } else {
+        pthread_mutex_lock(&tp->lock);
+        status = _tp_lane_push(tp, lane, task);
+        pthread_mutex_unlock(&tp->lock);
+    }
+
+    if (status) {
+        _tp_notify(tp);
+    } else {
+        _tp_release(tp, 1);
+    }
+
+EXIT:
+    return status;
+}
+
+
+/**
+ * Wait until the task fits in the shared queues, at most
+ * `attr.overflow_timeout_us`, or until the pool is shut down.
+ */
+bool _tp_wait_room(thread_pool_t *tp, tp_task_t *task)
+{
+    bool status = false;
+    uint32_t seq;
+    uint64_t now;
+    uint64_t deadline = TP_SYNC_INFINITE;
+
+    if (tp->attr.overflow_timeout_us != TP_TIMEOUT_INFINITE) {
+        deadline = tp_now_ns() + tp->attr.overflow_timeout_us * 1000;
+    }
+
+    __sync_add_and_fetch(&tp->overflow_stats.blocked, 1);
+    __atomic_add_fetch(&tp->nblocked, 1, __ATOMIC_SEQ_CST);
+
+    while (!__atomic_load_n(&tp->stopping, __ATOMIC_ACQUIRE)) {
+        seq = __atomic_load_n(&tp->room_seq, __ATOMIC_SEQ_CST);
+
+        if (_tp_enqueue(tp, task)) {
+            status = true;
+            break;
+        }
+
+        if (deadline == TP_SYNC_INFINITE) {
+            tp_sync_wait(&tp->room_seq, seq, TP_SYNC_INFINITE);
+            continue;
+        }
+
+        now = tp_now_ns();
+
+        if (now >= deadline) {
+            __sync_add_and_fetch(&tp->overflow_stats.timed_out, 1);
+            break;
+        }
+
+        tp_sync_wait(&tp->room_seq, seq, deadline - now);
+    }
+
+    __atomic_sub_fetch(&tp->nblocked, 1, __ATOMIC_SEQ_CST);
+
+    return status;
+}
+
+
+/**
+ * Discard the oldest queued task of the lowest class until the task fits.
+ */
+bool _tp_drop_oldest(thread_pool_t *tp, tp_task_t *task)
+{
+    uint32_t i;
+    uint32_t node;
+    uint32_t tries;
+    tp_task_t *victim;
+
+    for (tries = 0; tries < TP_DROP_TRIES; ++tries) {
+        victim = NULL;
+
+        for (i = tp->nlane; i > 0 && victim == NULL; --i) {
+            for (node = 0; node < tp->nnode && victim == NULL; ++node) {
+                victim = _tp_lane_take(tp, &_tp_node_lanes(tp, node)[i - 1]);
+            }
+        }
+
+        if (victim) {
+            __sync_add_and_fetch(&tp->overflow_stats.dropped, 1);
+            _tp_discard_task(victim, true);
+            _tp_task_done(tp);
+        }
+
+        if (_tp_enqueue(tp, task)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Apply `attr.overflow` to a counted task which didn't fit in the queues.
+ *
+ * @return true: the task was posted or run
+ *         false: it still belongs to the caller
+ */
+bool _tp_overflow(thread_pool_t *tp, tp_task_t *task)
+{
+    bool status = false;
+    tp_overflow_t policy = tp->attr.overflow;
+    tp_worker_t *self = g_worker;
+
+    // A worker waiting for room in its own pool may wait forever
+    if (policy == TP_OVERFLOW_BLOCK && self && self->pool == tp) {
+        policy = TP_OVERFLOW_CALLER_RUNS;
+    }
+
+    switch (policy) {
+        case TP_OVERFLOW_BLOCK:
+            status = _tp_wait_room(tp, task);
+            break;
+        case TP_OVERFLOW_CALLER_RUNS:
+            __sync_add_and_fetch(&tp->overflow_stats.caller_runs, 1);
+            _tp_run_task(tp, task);
+            status = true;
+            break;
+        case TP_OVERFLOW_DROP_OLDEST:
+            status = _tp_drop_oldest(tp, task);
+            break;
+        default:
+            break;
+    }
+
+    if (!status) {
+        __sync_add_and_fetch(&tp->overflow_stats.rejected, 1);
+        _tp_metric_add(tp, rejected, 1);
+    }
+
+    return status;
+}
+
+
+/**
+ * Post a task whose post was already recorded in the trace.
+ */
+bool _tp_post_task(thread_pool_t *tp, tp_task_t *task)
+{
+    bool status = false;
+
+    // Nothing would run it until the pool is restarted
+    if (__atomic_load_n(&tp->stopping, __ATOMIC_ACQUIRE)) {
+        goto EXIT;
+    }
+
+    // Count it before publishing, otherwise a worker may finish
+    // the task and decrease the counter before we increase it.
+    __sync_add_and_fetch(&tp->active_tasks, 1);
+
+    if (_tp_deps_pending(task) && _tp_deps_hold(tp, task)) {
+        _tp_metric_add(tp, posted, 1);
+        status = true;
+        goto EXIT;
+    }
+
+    if (!_tp_enqueue(tp, task) && !_tp_overflow(tp, task)) {
+        __sync_sub_and_fetch(&tp->active_tasks, 1);
+        goto EXIT;
+    }
+
+    _tp_metric_add(tp, posted, 1);
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+bool tp_post_task(thread_pool_t *tp, tp_task_t *task)
+{
+    if (tp == NULL || task == NULL) {
+        return false;
+    }
+
+    // Before it's published: a worker, the overflow policy or the last
+    // predecessor may run and free it right away
+    tp_trace(tp, g_worker, TP_TRACE_POST, task);
+
+    return _tp_post_task(tp, task);
+}
+
+
+bool tp_post_task_node(thread_pool_t *tp, tp_task_t *task, uint32_t node)
+{
+    if (task == NULL) {
+        return false;
+    }
+
+    task->node = TP_NODE_ANY;
+
+    if (tp && tp->nnode > 1 && node != TP_NODE_ANY) {
+        task->node = tp_topo_find_node(tp->topo, (int) node);
+    }
+
+    return tp_post_task(tp, task);
+}
+
+
+bool tp_post_task_priority(thread_pool_t *tp, tp_task_t *task, uint32_t priority)
+{
+    if (task == NULL) {
+        return false;
+    }
+
+    task->priority = priority;
+
+    return tp_post_task(tp, task);
+}
+
+
+/**
+ * Publish a batch to a lane without waking anyone, returning the
+ * number of tasks accepted, which are always the first ones of the batch.
+ */
+int _tp_lane_push_batch(thread_pool_t *tp, tp_lane_t *lane, tp_task_t *tasks[], int ntask)
+{
+    int i;
+    int n;
+    int posted = 0;
+    queue_t batch;
+    tp_task_list_t chain;
+    qdata_t data[TP_BATCH_CHUNK];
+
+    switch (tp->attr.queue_kind) {
+        case TP_QUEUE_RING:
+            // Claim the slots of each chunk with one CAS, no lock
+            while (posted < ntask) {
+                n = ntask - posted < TP_BATCH_CHUNK ? ntask - posted : TP_BATCH_CHUNK;
+
+                for (i = 0; i < n; ++i) {
+                    data[i].ptr = tasks[posted + i];
+                }
+
+                i = (int) ring_enqueue_bulk(&lane->ring, data, (uint32_t) n);
+                posted += i;
+
+                if (i < n) {
+                    break;
+                }
+            }
+
+            break;
+
+        case TP_QUEUE_INTRUSIVE:
+            // Link the batch outside of the lock, splice it in O(1)
+            bzero(&chain, sizeof(chain));
+
+            for (i = 0; i < ntask; ++i) {
+                _tp_task_list_push(&chain, tasks[i]);
+            }
+
+            posted = ntask;
+
+            pthread_mutex_lock(&tp->lock);
+
+            if (lane->list.tail) {
+                lane->list.tail->next = chain.head;
+            } else {
+                lane->list.head = chain.head;
+            }
+
+            lane->list.tail = chain.tail;
+            lane->list.len += chain.len;
+
+            pthread_mutex_unlock(&tp->lock);
+            break;
+
+        default:
+            // Allocate the nodes outside of the lock, append them in O(1)
+            queue_init(&batch);
+
+            for (i = 0; i < ntask; ++i) {
+                data[0].ptr = tasks[i];
+
+                if (!queue_enqueue(&batch, data[0])) {
+                    break;
+                }
+            }
+
+            posted = (int) queue_len(&batch);
+
+            pthread_mutex_lock(&tp->lock);
+            queue_append(&lane->queue, &batch);
+            pthread_mutex_unlock(&tp->lock);
+            break;
+    }
+
+    if (posted) {
+        _tp_lane_mark(tp, lane);
+    }
+
+    return posted;
+}
+
+
+/**
+ * Publish a batch to the shared queues, one run of tasks of the same
+ * class and node at once, stopping at the first run which isn't fully accepted.
+ */
+int _tp_enqueue_batch(thread_pool_t *tp, tp_task_t *tasks[], int ntask)
+{
+    int i;
+    int n;
+    int posted = 0;
+    uint32_t home;
+    uint32_t reserved;
+    uint64_t now;
+    tp_lane_t *lane;
+    tp_worker_t *self = g_worker;
+
+    home = self && self->pool == tp ? self->node : _tp_current_node(tp);
+
+    // Only the ones which fit are published
+    reserved = _tp_reserve(tp, (uint32_t) ntask);
+    ntask = (int) reserved;
+
+    if (tp->attr.metrics || _tp_elastic(tp)) {
+        now = tp_now_ns();
+
+        for (i = 0; i < ntask; ++i) {
+            tasks[i]->post_ns = now;
+        }
+    }
+
+    while (posted < ntask) {
+        lane = _tp_task_lane(tp, tasks[posted], home);
+
+        for (i = posted + 1; i < ntask; ++i) {
+            if (_tp_task_lane(tp, tasks[i], home) != lane) {
+                break;
+            }
+        }
+
+        n = _tp_lane_push_batch(tp, lane, tasks + posted, i - posted);
+        posted += n;
+
+        if (posted < i) {
+            break;
+        }
+    }
+
+    if ((uint32_t) posted < reserved) {
+        _tp_release(tp, reserved - (uint32_t) posted);
+    }
+
+    if (posted) {
+        _tp_notify_n(tp, (uint32_t) posted);
+    }
+
+    return posted;
+}
+
+
+int tp_post_tasks(thread_pool_t *tp, tp_task_t *tasks[], int ntask)
+{
+    int i;
+    int posted = 0;
+
+    if (tp == NULL || tasks == NULL || ntask <= 0
+        || __atomic_load_n(&tp->stopping, __ATOMIC_ACQUIRE)) {
+        goto EXIT;
+    }
+
+    // Tasks waiting for predecessors are held one by one
+    for (i = 0; i < ntask; ++i) {
+        if (_tp_deps_pending(tasks[i])) {
+            break;
+        }
+    }
+
+    if (i < ntask) {
+        while (posted < ntask && tp_post_task(tp, tasks[posted])) {
+            ++posted;
+        }
+
+        goto EXIT;
+    }
+
+    for (i = 0; i < ntask; ++i) {
+        tp_trace(tp, g_worker, TP_TRACE_POST, tasks[i]);
+    }
+
+    __sync_add_and_fetch(&tp->active_tasks, ntask);
+
+    posted = _tp_enqueue_batch(tp, tasks, ntask);
+
+    if (posted < ntask) {
+        __sync_sub_and_fetch(&tp->active_tasks, ntask - posted);
+    }
+
+    // tp_post_task() counts the rest itself
+    if (posted) {
+        _tp_metric_add(tp, posted, (uint64_t) posted);
+    }
+
+    // The ones which didn't fit
+    if (tp->attr.overflow == TP_OVERFLOW_FAIL) {
+        if (posted < ntask) {
+            __sync_add_and_fetch(&tp->overflow_stats.rejected, ntask - posted);
+            _tp_metric_add(tp, rejected, (uint64_t) (ntask - posted));
+        }
+    } else {
+        while (posted < ntask && _tp_post_task(tp, tasks[posted])) {
+            ++posted;
+        }
+    }
+
+EXIT:
+    return posted;
+}
+
+
+void tp_cleanup_unlock(void *args)
+{
+    thread_pool_t *pool = args;
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void tp_cleanup(void *args)
+{
+    UNUSED_PARAM(args);
+//    fprintf(stderr, "thread ended\n");
+}
+
+
+/**
+ * Try to steal a task from the other workers, starting
+ * from a random victim. `self` is NULL for non-pool threads.
+ */
+tp_task_t *_tp_steal(thread_pool_t *pool, tp_worker_t *self)
+{
+    uint32_t i;
+    uint32_t start;
+    qdata_t data;
+    tp_worker_t *victim;
+    tp_task_t *task;
+
+    if ((pool->attr.sched != TP_SCHED_STEALING && !pool->attr.lifo_slot)
+        || pool->nthread < 2) {
+        return NULL;
+    }
+
+    if (self) {
+        // xorshift32
+        self->seed ^= self->seed << 13;
+        self->seed ^= self->seed >> 17;
+        self->seed ^= self->seed << 5;
+        start = self->seed % pool->nthread;
+    } else {
+        start = (uint32_t) (tp_now_ns() % pool->nthread);
+    }
+
+    for (i = 0; i < pool->nthread; ++i) {
+        victim = &pool->workers[(start + i) % pool->nthread];
+
+        if (victim == self) {
+            continue;
+        }
+
+        // deque_steal() fails on contention as well, retry until it's empty
+        while (pool->attr.sched == TP_SCHED_STEALING && !deque_isempty(&victim->deque)) {
+            if (deque_steal(&victim->deque, &data)) {
+                _tp_metric_add(pool, stolen, 1);
+                return data.ptr;
+            }
+        }
+
+        // The victim is busy, or it would have run it already
+        if ((task = _tp_lifo_steal(victim)) != NULL) {
+            _tp_metric_add(pool, stolen, 1);
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Count the tasks a worker took while a lower class was waiting.
+ */
+void _tp_age(thread_pool_t *pool, tp_worker_t *self, tp_lane_t *lanes, uint32_t index)
+{
+    uint32_t i;
+
+    for (i = index + 1; i < pool->nlane; ++i) {
+        if (_tp_lane_len(pool, &lanes[i]) > 0) {
+            ++self->prio_streak;
+            return;
+        }
+    }
+
+    self->prio_streak = 0;
+}
+
+
+/**
+ * Take a task without blocking: the classes above normal first,
+ * then own deque, then the other classes, then the other nodes'
+ * queues, then the other workers' deques. Once a worker passed over
+ * a waiting lower class `priority_aging` times, it serves the lowest
+ * waiting class. `self` is NULL for non-pool threads helping to run tasks.
+ */
+tp_task_t *_tp_try_take(thread_pool_t *pool, tp_worker_t *self)
+{
+    uint32_t i;
+    uint32_t n;
+    uint32_t split = 0;
+    uint32_t home = self ? self->node : _tp_current_node(pool);
+    tp_lane_t *lanes = _tp_node_lanes(pool, home);
+    tp_lane_t *other;
+    qdata_t data;
+    tp_task_t *task = NULL;
+
+    if (self && pool->attr.priority_aging > 0
+        && self->prio_streak >= pool->attr.priority_aging) {
+        self->prio_streak = 0;
+
+        for (i = pool->nlane; i > 0; --i) {
+            task = _tp_lane_take(pool, &lanes[i - 1]);
+
+            if (task) {
+                __sync_add_and_fetch(&lanes[i - 1].aged, 1);
+                return task;
+            }
+        }
+    }
+
+    // The slot and the deque hold tasks of the normal class
+    if (self && (pool->attr.sched == TP_SCHED_STEALING || pool->attr.lifo_slot)) {
+        split = _tp_normal_lane(pool);
+    }
+
+    for (i = 0; i < split; ++i) {
+        task = _tp_lane_take(pool, &lanes[i]);
+
+        if (task) {
+            goto FOUND;
+        }
+    }
+
+    if (self && pool->attr.lifo_slot) {
+        if (self->lifo_streak < TP_LIFO_MAX_STREAK
+            && (task = __atomic_exchange_n(&self->lifo, NULL, __ATOMIC_ACQ_REL)) != NULL) {
+            ++self->lifo_streak;
+            goto FOUND;
+        }
+
+        self->lifo_streak = 0;
+    }
+
+    if (pool->attr.sched == TP_SCHED_STEALING && self) {
+        if (deque_pop(&self->deque, &data)) {
+            task = data.ptr;
+            goto FOUND;
+        }
+    }
+
+    for (i = split; i < pool->nlane; ++i) {
+        task = _tp_lane_take(pool, &lanes[i]);
+
+        if (task) {
+            goto FOUND;
+        }
+    }
+
+    // Nothing was waiting behind a slot skipped for the streak, take it
+    // rather than idling with a task of our own
+    if (self && pool->attr.lifo_slot
+        && (task = __atomic_exchange_n(&self->lifo, NULL, __ATOMIC_ACQ_REL)) != NULL) {
+        self->lifo_streak = 1;
+        i = split;
+        goto FOUND;
+    }
+
+    // The workers of the other nodes are busy, or they would have taken it
+    for (n = 1; n < pool->nnode; ++n) {
+        other = _tp_node_lanes(pool, (home + n) % pool->nnode);
+
+        for (i = 0; i < pool->nlane; ++i) {
+            task = _tp_lane_take(pool, &other[i]);
+
+            if (task) {
+                return task;
+            }
+        }
+    }
+
+    return _tp_steal(pool, self);
+
+FOUND:
+    if (self && pool->attr.priority_aging > 0) {
+        _tp_age(pool, self, lanes, i);
+    }
+
+    return task;
+}
+
+
+/**
+ * Poll for a task before parking, backing off exponentially from
+ * a few pause instructions to sched_yield(). In adaptive mode the
+ * spin is skipped when the recent idle gaps were longer than the
+ * budget, and cut to twice the average gap otherwise.
+ */
+tp_task_t *_tp_spin(thread_pool_t *pool, tp_worker_t *self, uint64_t start)
+{
+    uint32_t i;
+    uint32_t backoff = 1;
+    uint64_t limit = pool->attr.spin_us * 1000;
+    tp_task_t *task = NULL;
+
+    if (pool->attr.spin_adaptive && self->idle_ewma_ns > 0) {
+        if (self->idle_ewma_ns > limit) {
+            return NULL;
+        }
+
+        if (self->idle_ewma_ns * 2 < limit) {
+            limit = self->idle_ewma_ns * 2;
+        }
+    }
+
+    while (tp_now_ns() - start < limit) {
+        if (backoff < TP_SPIN_MAX_BACKOFF) {
+            for (i = 0; i < backoff; ++i) {
+                tp_cpu_relax();
+            }
+
+            backoff <<= 1;
+        } else {
+            sched_yield();
+        }
+
+        task = _tp_try_take(pool, self);
+
+        if (task || __atomic_load_n(&pool->stopping, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    return task;
+}
+
+
+/**
+ * Wait until someone post a task, or until the earliest timer is due
+ * if no other parked worker watches it. Returns the task found while
+ * getting ready to sleep, or NULL after being woken up.
+ */
+tp_task_t *_tp_park(thread_pool_t *pool, tp_worker_t *self)
+{
+    uint32_t i;
+    uint64_t now = 0;
+    uint64_t deadline;
+    uint64_t timer_deadline;
+    uint64_t idle_deadline = TP_SYNC_INFINITE;
+    bool timed_out = false;
+    bool claimed;
+    tp_task_t *task = NULL;
+
+    __atomic_store_n(&self->park, TP_WORKER_PARKED, __ATOMIC_RELAXED);
+
+    pthread_spin_lock(&pool->idle_lock);
+
+    // A late wakeup may have left us in the stack already
+    if (!self->in_idle) {
+        self->in_idle = true;
+        pool->idle[pool->nidle++] = self;
+    }
+
+    pthread_spin_unlock(&pool->idle_lock);
+
+    // Pairs with the one in _tp_notify_n(): either the producer
+    // sees us in the idle stack, or we see its task.
+    __sync_synchronize();
+
+    if (__atomic_load_n(&pool->stopping, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+
+    task = _tp_try_take(pool, self);
+
+    if (task == NULL) {
+        // Watch the earliest timer unless another parked worker does
+        timer_deadline = _tp_timer_arm(pool);
+        deadline = timer_deadline;
+
+        // Workers above the minimum retire after idling for a while
+        if (pool->attr.keep_alive_ms > 0
+            && __atomic_load_n(&pool->nlive, __ATOMIC_RELAXED)
+               > __atomic_load_n(&pool->min_threads, __ATOMIC_RELAXED)) {
+            idle_deadline = tp_now_ns() + (uint64_t) pool->attr.keep_alive_ms * 1000000;
+
+            if (idle_deadline < deadline) {
+                deadline = idle_deadline;
+            }
+        }
+
+        tp_trace(pool, self, TP_TRACE_PARK, NULL);
+
+        while (__atomic_load_n(&self->park, __ATOMIC_ACQUIRE) == TP_WORKER_PARKED) {
+            if (deadline == TP_SYNC_INFINITE) {
+                tp_sync_wait(&self->park, TP_WORKER_PARKED, TP_SYNC_INFINITE);
+                continue;
+            }
+
+            now = tp_now_ns();
+
+            if (now >= deadline) {
+                timed_out = true;
+                break;
+            }
+
+            tp_sync_wait(&self->park, TP_WORKER_PARKED, deadline - now);
+        }
+
+        tp_trace(pool, self, TP_TRACE_WAKE, NULL);
+
+        if (timer_deadline != TP_SYNC_INFINITE) {
+            if (_tp_timer_disarm(pool, timer_deadline) && !timed_out) {
+                // Woken up for a task, hand the timers to another idle worker
+                _tp_notify(pool);
+            }
+        }
+
+        if (!timed_out) {
+            return NULL;
+        }
+    }
+
+    // Leave the idle stack unless a producer already took us out
+    pthread_spin_lock(&pool->idle_lock);
+
+    claimed = !self->in_idle;
+
+    if (self->in_idle) {
+        for (i = 0; i < pool->nidle; ++i) {
+            if (pool->idle[i] == self) {
+                pool->idle[i] = pool->idle[--pool->nidle];
+                break;
+            }
+        }
+
+        self->in_idle = false;
+    }
+
+    pthread_spin_unlock(&pool->idle_lock);
+
+    __atomic_store_n(&self->park, TP_WORKER_RUNNING, __ATOMIC_RELAXED);
+
+    // Nobody expects us to take a task, it's safe to leave
+    if (task == NULL && !claimed && now >= idle_deadline) {
+        _tp_retire(pool, self, __atomic_load_n(&pool->min_threads, __ATOMIC_RELAXED));
+    }
+
+    return task;
+}
+
+
+/**
+ * Account a task which was run or discarded.
+ */
+void _tp_task_done(thread_pool_t *pool)
+{
+    // Note: the shared queues are empty DO NOT means there is no task
+    //
+    // If there is no task remain in the queue after dequeue operation,
+    // signal for tp_join_task(). Signal it under the lock, otherwise
+    // it may be lost between the check and the wait of tp_join_tasks().
+    if (__sync_sub_and_fetch(&pool->active_tasks, 1) == 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->no_task);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+void _tp_run_task(thread_pool_t *pool, tp_task_t *task)
+{
+    void *result;
+    bool rescheduled;
+    uint64_t start;
+    tp_task_t *next;
+    tp_task_t *outer;
+    tp_worker_t *self = g_worker;
+
+    // A successor made ready by the task runs next on this thread,
+    // while what its predecessor left is still in the cache
+    for (; task; task = next) {
+        result = NULL;
+        rescheduled = false;
+        start = 0;
+        next = NULL;
+
+        // Only the workers of the pool own a histogram
+        if (self && self->pool == pool && pool->attr.metrics) {
+            start = tp_now_ns();
+        }
+
+        tp_trace(pool, self, TP_TRACE_START, task);
+
+        if (task->runner) {
+            // Tasks run while helping nest in the runner
+            outer = g_task;
+            g_task = task;
+            result = task->runner(task->args);
+            g_task = outer;
+
+            // The next stage still needs the args
+            if (task->cleanup && !task->handoff) {
+                task->cleanup(task->args);
+            }
+        }
+
+        tp_trace(pool, self, TP_TRACE_END, task);
+
+        if (start) {
+            hist_record(&self->metrics.run_ns, tp_now_ns() - start);
+        }
+
+        // The task belongs to the other pool once handed off
+        if (task->handoff) {
+            _tp_handoff(task);
+            _tp_metric_add(pool, completed, 1);
+            _tp_task_done(pool);
+            continue;
+        }
+
+        if (task->future) {
+            _tp_future_complete(task->future, TP_FUTURE_READY, result);
+            task->future = NULL;
+        }
+
+        if (task->group) {
+            tp_group_done(task->group);
+            task->group = NULL;
+        }
+
+        if (task->interval_ns) {
+            rescheduled = _tp_timer_resched(pool, task);
+        }
+
+        // A periodic task releases its successors after its last run,
+        // or in _tp_timer_poll() if it's cancelled between runs
+        if (task->nsucc && !rescheduled) {
+            next = _tp_deps_done(pool, task);
+        }
+
+        // Before the task is done, so it's counted once tp_join_tasks() returns
+        _tp_metric_add(pool, completed, 1);
+        _tp_task_done(pool);
+
+        if (!rescheduled) {
+            tp_task_free(task);
+        }
+    }
+}
+
+
+/**
+ * Wait for a task, spinning first if it's enabled,
+ * keeping track of how long the worker stays idle.
+ * Returns NULL when the worker retired or the pool is stopping.
+ */
+tp_task_t *_tp_idle(thread_pool_t *pool, tp_worker_t *self)
+{
+    uint64_t start = 0;
+    uint64_t gap;
+    tp_task_t *task = NULL;
+
+    if (pool->attr.spin_us > 0) {
+        start = tp_now_ns();
+        task = _tp_spin(pool, self, start);
+    }
+
+    while (task == NULL) {
+        task = _tp_park(pool, self);
+
+        if (self->slot == TP_SLOT_EXITED) {
+            return NULL;
+        }
+
+        if (task == NULL) {
+            // Woken up by tp_resize() shrinking the pool
+            if (_tp_over_max(pool)
+                && _tp_retire(pool, self, __atomic_load_n(&pool->max_threads, __ATOMIC_RELAXED))) {
+                return NULL;
+            }
+
+            _tp_timer_poll(pool);
+            task = _tp_try_take(pool, self);
+
+            // Nothing left to drain
+            if (task == NULL && __atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+        }
+    }
+
+    if (start) {
+        // EWMA with a weight of 1/8 for the newest gap
+        gap = tp_now_ns() - start;
+        self->idle_ewma_ns = self->idle_ewma_ns - self->idle_ewma_ns / 8 + gap / 8;
+    }
+
+    return task;
+}
+
+
+void *tp_worker(void *args)
+{
+    tp_worker_t *self = args;
+    thread_pool_t *pool = self->pool;
+    tp_task_t *task = NULL;
+
+    g_worker = self;
+
+    pthread_cleanup_push(tp_cleanup, pool) ;
+
+            while (1) {
+                // Leave when the pool was shrunk
+                if (_tp_over_max(pool)
+                    && _tp_retire(pool, self, __atomic_load_n(&pool->max_threads, __ATOMIC_RELAXED))) {
+                    break;
+                }
+
+                // Leave when shut down, after the queued tasks if draining
+                if (__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE)
+                    && __atomic_load_n(&pool->drain, __ATOMIC_RELAXED) != TP_DRAIN_QUEUED) {
+                    break;
+                }
+
+                // Take a task, if there is none wait until someone post one.
+                _tp_timer_poll(pool);
+                task = _tp_try_take(pool, self);
+
+                if (task == NULL) {
+                    task = _tp_idle(pool, self);
+
+                    if (task == NULL) {
+                        break;
+                    }
+                }
+
+                if (pool->attr.metrics || _tp_elastic(pool)) {
+                    _tp_on_take(pool, self, task);
+                }
+
+                // Run a task
+                _tp_run_task(pool, task);
+                task = NULL;
+
+                if (self->arena.used && !pool->attr.arena_keep) {
+                    arena_reset(&self->arena);
+                }
+            }
+
+    pthread_cleanup_pop(0);
+
+    return NULL;
+}
+
+
+
+/* ---------------- Future API ---------------- */
+
+
+/**
+ * Publish the result and drop the task's reference.
+ */
+void _tp_future_complete(tp_future_t *future, tp_future_state_t state, void *result)
+{
+    future->result = result;
+
+    if (__atomic_exchange_n(&future->state, state, __ATOMIC_ACQ_REL) == TP_FUTURE_WAITING) {
+        tp_sync_wake_all(&future->state);
+    }
+
+    tp_future_release(future);
+}
+
+
+tp_future_t *tp_post_task_future(thread_pool_t *tp, tp_task_t *task)
+{
+    tp_future_t *future = NULL;
+
+    if (tp == NULL || task == NULL || task->future) {
+        goto EXIT;
+    }
+
+    future = malloc(sizeof(tp_future_t));
+
+    if (future == NULL) {
+        goto EXIT;
+    }
+
+    future->state = TP_FUTURE_PENDING;
+    // one for the caller, one for the task
+    future->refs = 2;
+    future->result = NULL;
+
+    task->future = future;
+
+    if (!tp_post_task(tp, task)) {
+        task->future = NULL;
+        free(future);
+        future = NULL;
+    }
+
+EXIT:
+    return future;
+}
+
+
+bool tp_future_try_get(tp_future_t *future, void **result)
+{
+    if (__atomic_load_n(&future->state, __ATOMIC_ACQUIRE) < TP_FUTURE_READY) {
+        return false;
+    }
+
+    if (result) {
+        *result = future->result;
+    }
+
+    return true;
+}
+
+
+bool tp_future_wait_for(tp_future_t *future, uint64_t timeout_us, void **result)
+{
+    int i;
+    uint32_t state;
+    uint64_t now;
+    uint64_t deadline = TP_SYNC_INFINITE;
+
+    for (i = 0; i < TP_FUTURE_SPIN; ++i) {
+        if (tp_future_try_get(future, result)) {
+            return true;
+        }
+
+        tp_cpu_relax();
+    }
+
+    if (timeout_us != TP_SYNC_INFINITE) {
+        deadline = tp_now_ns() + timeout_us * 1000;
+    }
+
+    while ((state = __atomic_load_n(&future->state, __ATOMIC_ACQUIRE)) < TP_FUTURE_READY) {
+        // Tell the completer someone has to be woken up
+        if (state == TP_FUTURE_PENDING
+            && !__atomic_compare_exchange_n(&future->state, &state, TP_FUTURE_WAITING, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        if (deadline == TP_SYNC_INFINITE) {
+            tp_sync_wait(&future->state, TP_FUTURE_WAITING, TP_SYNC_INFINITE);
+        } else {
+            now = tp_now_ns();
+
+            if (now >= deadline) {
+                return false;
+            }
+
+            tp_sync_wait(&future->state, TP_FUTURE_WAITING, deadline - now);
+        }
+    }
+
+    return tp_future_try_get(future, result);
+}
+
+
+void *tp_future_wait(tp_future_t *future)
+{
+    void *result = NULL;
+
+    tp_future_wait_for(future, TP_SYNC_INFINITE, &result);
+
+    return result;
+}
+
+
+void tp_future_release(tp_future_t *future)
+{
+    if (future && __sync_sub_and_fetch(&future->refs, 1) == 0) {
+        free(future);
+    }
+}
+
+
+/* ---------------- Timer API ---------------- */
+
+
+/**
+ * Add a task to the timer heap, waking up an idle worker to watch
+ * it if it's due before the one parked worker watching the timers.
+ */
+bool _tp_timer_add(thread_pool_t *tp, tp_task_t *task, uint64_t due_ns, bool notify)
+{
+    bool status = false;
+    qdata_t data;
+
+    data.ptr = task;
+    task->due_ns = due_ns;
+
+    pthread_mutex_lock(&tp->timer_lock);
+
+    status = heap_push(&tp->timers, due_ns, data);
+
+    if (status && due_ns < tp->timer_next_ns) {
+        __atomic_store_n(&tp->timer_next_ns, due_ns, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&tp->timer_lock);
+
+    if (!status) {
+        perror("failed to grow the timer heap");
+        goto EXIT;
+    }
+
+    // Pairs with the barrier in _tp_park(): either a parking worker
+    // sees the new timer, or we see its deadline.
+    __sync_synchronize();
+
+    if (notify && due_ns < __atomic_load_n(&tp->timer_armed_ns, __ATOMIC_RELAXED)) {
+        _tp_notify(tp);
+    }
+
+EXIT:
+    return status;
+}
+
+
+/**
+ * Put a periodic task back to the heap after a run,
+ * skipping the runs it's missed.
+ */
+bool _tp_timer_resched(thread_pool_t *pool, tp_task_t *task)
+{
+    uint64_t now;
+    uint64_t due = task->due_ns + task->interval_ns;
+
+    if (__atomic_load_n(&task->cancelled, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    now = tp_now_ns();
+
+    if (due <= now) {
+        due += ((now - due) / task->interval_ns + 1) * task->interval_ns;
+    }
+
+    // No need to wake anyone, the worker checks the timers before parking
+    return _tp_timer_add(pool, task, due, false);
+}
+
+
+/**
+ * Move the due timers to the task queues. Only one thread does it at
+ * a time, the others go on with their tasks.
+ */
+void _tp_timer_poll(thread_pool_t *pool)
+{
+    uint32_t i;
+    uint32_t n;
+    uint64_t now;
+    heap_node_t node;
+    tp_task_t *next;
+    tp_task_t *due[TP_TIMER_CHUNK];
+
+    // The pending timers are discarded by tp_shutdown()
+    if (__atomic_load_n(&pool->timer_next_ns, __ATOMIC_RELAXED) == TP_SYNC_INFINITE
+        || __atomic_load_n(&pool->stopping, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    now = tp_now_ns();
+
+    do {
+        if (now < __atomic_load_n(&pool->timer_next_ns, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        if (pthread_mutex_trylock(&pool->timer_lock)) {
+            break;
+        }
+
+        n = 0;
+
+        while (n < TP_TIMER_CHUNK && heap_top(&pool->timers, &node) && node.key <= now) {
+            heap_pop(&pool->timers, NULL);
+            due[n++] = node.data.ptr;
+        }
+
+        __atomic_store_n(&pool->timer_next_ns,
+                         heap_top(&pool->timers, &node) ? node.key : TP_SYNC_INFINITE,
+                         __ATOMIC_RELAXED);
+
+        pthread_mutex_unlock(&pool->timer_lock);
+
+        for (i = 0; i < n; ++i) {
+            if (__atomic_load_n(&due[i]->cancelled, __ATOMIC_ACQUIRE)) {
+                // Stopped between runs, its successors go on as after a last run
+                if (due[i]->nsucc) {
+                    next = _tp_deps_done(pool, due[i]);
+
+                    if (next && !_tp_enqueue(pool, next)) {
+                        _tp_run_task(pool, next);
+                    }
+                }
+
+                tp_task_free(due[i]);
+                continue;
+            }
+
+            __sync_add_and_fetch(&pool->active_tasks, 1);
+
+            if (!_tp_enqueue(pool, due[i])) {
+                // The queue is full, run it here rather than dropping it
+                _tp_run_task(pool, due[i]);
+            }
+        }
+    } while (n == TP_TIMER_CHUNK);
+}
+
+
+/**
+ * Claim watching the earliest timer before parking.
+ *
+ * @return the time to wake up at, or TP_SYNC_INFINITE if there is no
+ *         timer or another parked worker wakes up early enough
+ */
+uint64_t _tp_timer_arm(thread_pool_t *pool)
+{
+    uint64_t next = __atomic_load_n(&pool->timer_next_ns, __ATOMIC_RELAXED);
+    uint64_t armed = __atomic_load_n(&pool->timer_armed_ns, __ATOMIC_RELAXED);
+
+    while (next < armed) {
+        if (__atomic_compare_exchange_n(&pool->timer_armed_ns, &armed, next, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return next;
+        }
+    }
+
+    return TP_SYNC_INFINITE;
+}
+
+
+/**
+ * Give up watching the timers after waking up.
+ *
+ * @return true: we were still the one watching them
+ *         false: another worker took it over with an earlier deadline
+ */
+bool _tp_timer_disarm(thread_pool_t *pool, uint64_t deadline)
+{
+    return __atomic_compare_exchange_n(&pool->timer_armed_ns, &deadline, TP_SYNC_INFINITE,
+                                       false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Free the tasks still waiting in the timer heap.
+ */
+void _tp_timer_destroy(thread_pool_t *tp)
+{
+    heap_node_t node;
+
+    while (heap_pop(&tp->timers, &node)) {
+        tp_task_free(node.data.ptr);
+    }
+
+    heap_destroy(&tp->timers);
+}
+
+
+bool tp_post_delayed(thread_pool_t *tp, tp_task_t *task, uint64_t delay_us)
+{
+    bool status = false;
+
+    if (tp == NULL || task == NULL || __atomic_load_n(&tp->stopping, __ATOMIC_ACQUIRE)) {
+        goto EXIT;
+    }
+
+    task->interval_ns = 0;
+    status = _tp_timer_add(tp, task, tp_now_ns() + delay_us * 1000, true);
+
+EXIT:
+    return status;
+}
+
+
+bool tp_post_periodic(thread_pool_t *tp, tp_task_t *task,
+                      uint64_t delay_us, uint64_t interval_us)
+{
+    bool status = false;
+
+    if (tp == NULL || task == NULL || interval_us == 0
+        || __atomic_load_n(&tp->stopping, __ATOMIC_ACQUIRE)) {
+        goto EXIT;
+    }
+
+    // They would be completed by the first run
+    if (task->future || task->group) {
+        goto EXIT;
+    }
+
+    task->interval_ns = interval_us * 1000;
+    task->cancelled = 0;
+    status = _tp_timer_add(tp, task, tp_now_ns() + delay_us * 1000, true);
+
+EXIT:
+    return status;
+}
+
+
+void tp_cancel_periodic(tp_task_t *task)
+{
+    if (task) {
+        __atomic_store_n(&task->cancelled, 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+/* ---------------- Task Group API ---------------- */
+
+
+void tp_group_init(tp_group_t *group)
+{
+    if (group) {
+        bzero(group, sizeof(tp_group_t));
+    }
+}
+
+
+void tp_group_add(tp_group_t *group, uint32_t n)
+{
+    __sync_add_and_fetch(&group->pending, n);
+}
+
+
+void tp_group_done(tp_group_t *group)
+{
+    // A released waiter may free the group at once, only its
+    // address is used for the wakeup
+    if (__sync_fetch_and_sub(&group->pending, 1) == (TP_GROUP_WAITING | 1)) {
+        tp_sync_wake_all(&group->pending);
+    }
+}
+
+
+bool tp_group_post(thread_pool_t *tp, tp_group_t *group, tp_task_t *task)
+{
+    bool status = false;
+
+    if (tp == NULL || group == NULL || task == NULL || task->group) {
+        goto EXIT;
+    }
+
+    tp_group_add(group, 1);
+    task->group = group;
+
+    if (!tp_post_task(tp, task)) {
+        task->group = NULL;
+        tp_group_done(group);
+        goto EXIT;
+    }
+
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+void tp_group_wait(thread_pool_t *tp, tp_group_t *group, bool help)
+{
+    int i;
+    uint32_t pending;
+    tp_task_t *task;
+    tp_worker_t *self = g_worker;
+
+    if (self && self->pool != tp) {
+        self = NULL;
+    }
+
+    while (1) {
+        for (i = 0; i < TP_FUTURE_SPIN; ++i) {
+            pending = __atomic_load_n(&group->pending, __ATOMIC_ACQUIRE);
+
+            if ((pending & ~TP_GROUP_WAITING) == 0) {
+                // Spare the next last tp_group_done() a wakeup call
+                if (pending) {
+                    __sync_bool_compare_and_swap(&group->pending, pending, 0);
+                }
+
+                return;
+            }
+
+            // Run queued tasks instead of sleeping, they may
+            // belong to the group or hold up its tasks
+            if (help && tp && (task = _tp_try_take(tp, self)) != NULL) {
+                _tp_run_task(tp, task);
+                i = 0;
+                continue;
+            }
+
+            tp_cpu_relax();
+        }
+
+        pending = __atomic_load_n(&group->pending, __ATOMIC_ACQUIRE);
+
+        if ((pending & ~TP_GROUP_WAITING) == 0) {
+            continue;
+        }
+
+        // Ask the last tp_group_done() for a wakeup, in the word it counts down
+        if (!(pending & TP_GROUP_WAITING)) {
+            if (!__sync_bool_compare_and_swap(&group->pending, pending, pending | TP_GROUP_WAITING)) {
+                continue;
+            }
+
+            pending |= TP_GROUP_WAITING;
+        }
+
+        // When helping, wake up periodically to look for new tasks
+        tp_sync_wait(&group->pending, pending,
+                     help ? TP_GROUP_HELP_POLL_NS : TP_SYNC_INFINITE);
+    }
+}
+
+
+/* ---------------- Task Graph API ---------------- */
+
+
+bool tp_task_then(tp_task_t *task, tp_task_t *next)
+{
+    bool status = false;
+    tp_task_t **succ;
+
+    if (task == NULL || next == NULL || task == next) {
+        goto EXIT;
+    }
+
+    succ = realloc(task->succ, (task->nsucc + 1) * sizeof(tp_task_t *));
+
+    if (succ == NULL) {
+        perror("failed to allocate successors");
+        goto EXIT;
+    }
+
+    task->succ = succ;
+    task->succ[task->nsucc++] = next;
+
+    // An earlier predecessor may be finishing meanwhile
+    __sync_add_and_fetch(&next->deps, 1);
+
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+/**
+ * Hold back a posted task until its predecessors finish.
+ *
+ * @return true: it's held, or discarded since a predecessor was destroyed
+ *         false: it's ready to be queued
+ */
+bool _tp_deps_hold(thread_pool_t *tp, tp_task_t *task)
+{
+    if (__atomic_load_n(&task->deps, __ATOMIC_ACQUIRE) > 1) {
+        task->dep_pool = tp;
+
+        // Drop the hold of tp_task_init(), the last predecessor queues it
+        if (__sync_sub_and_fetch(&task->deps, 1) > 0) {
+            return true;
+        }
+    }
+
+    if (__atomic_load_n(&task->dep_cancelled, __ATOMIC_ACQUIRE)) {
+        _tp_discard_task(task, true);
+        _tp_task_done(tp);
+        return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * Count a finished task out of its successors. The first one which
+ * became ready in `pool` is returned to run next on this thread,
+ * the others are queued to their pools.
+ */
+tp_task_t *_tp_deps_done(thread_pool_t *pool, tp_task_t *task)
+{
+    uint32_t i;
+    tp_task_t *succ;
+    tp_task_t *next = NULL;
+    thread_pool_t *tp;
+
+    for (i = 0; i < task->nsucc; ++i) {
+        succ = task->succ[i];
+
+        if (__sync_sub_and_fetch(&succ->deps, 1) > 0) {
+            continue;
+        }
+
+        tp = succ->dep_pool;
+
+        if (__atomic_load_n(&succ->dep_cancelled, __ATOMIC_ACQUIRE)) {
+            _tp_discard_task(succ, true);
+            _tp_task_done(tp);
+        } else if (next == NULL && tp == pool) {
+            next = succ;
+        } else if (!_tp_enqueue(tp, succ)) {
+            // It's counted already, run it here when there's no room
+            _tp_run_task(tp, succ);
+        }
+    }
+
+    free(task->succ);
+    task->succ = NULL;
+    task->nsucc = 0;
+
+    return next;
+}
+
+
+/**
+ * Discard the successors of a task destroyed without running,
+ * the ones not posted yet are discarded when they are.
+ */
+void _tp_deps_cancel(tp_task_t *task)
+{
+    uint32_t i;
+    tp_task_t *succ;
+    thread_pool_t *tp;
+
+    for (i = 0; i < task->nsucc; ++i) {
+        succ = task->succ[i];
+        __atomic_store_n(&succ->dep_cancelled, 1, __ATOMIC_RELEASE);
+
+        if (__sync_sub_and_fetch(&succ->deps, 1) == 0) {
+            tp = succ->dep_pool;
+            _tp_discard_task(succ, true);
+            _tp_task_done(tp);
+        }
+    }
+
+    free(task->succ);
+    task->succ = NULL;
+    task->nsucc = 0;
+}
+
+
+/* ---------------- Handoff API ---------------- */
+
+
+bool tp_task_handoff(thread_pool_t *tp, runnable_t runner)
+{
+    bool status = false;
+    tp_task_t *task = g_task;
+
+    if (tp == NULL || runner == NULL || task == NULL) {
+        goto EXIT;
     }
 
-    if (pthread_mutex_destroy(&tp->lock)) {
-        perror("pthread_mutex_destroy()");
+    // A periodic task stays in its pool's timer heap
+    if (task->interval_ns) {
+        goto EXIT;
     }
 
-    if (g_self_key_inited) {
-        _tp_self_destroy(tp);
-        g_self_key_inited = false;
-    }
+    task->handoff = tp;
+    task->handoff_runner = runner;
 
-    queue_clear(&tp->task_queue);
+    status = true;
 
-    bzero(tp, sizeof(thread_pool_t));
+EXIT:
+    return status;
 }
 
 
-void tp_join(thread_pool_t *tp)
+/**
+ * Post a task whose runner returned to the pool it was handed off to.
+ */
+void _tp_handoff(tp_task_t *task)
 {
-    int i;
+    thread_pool_t *tp = task->handoff;
 
-    if (tp && tp->threads) {
-        for (i = 0; i < (int) tp->nthread; ++i) {
-            // todo: check return value
-            if (pthread_join(tp->threads[i], NULL)) {
-                perror("pthread_join() failed");
-            }
-        }
+    task->runner = task->handoff_runner;
+    task->handoff = NULL;
+    task->handoff_runner = NULL;
+
+    // Nodes are numbered per pool
+    task->node = TP_NODE_ANY;
+
+    if (!tp_post_task(tp, task)) {
+        __sync_add_and_fetch(&tp->active_tasks, 1);
+        _tp_run_task(tp, task);
     }
 }
 
 
-bool tp_join_tasks(thread_pool_t *tp)
+/* ---------------- Parallel API ---------------- */
+
+
+/**
+ * Whether a piece split off now would be picked up soon: somebody is
+ * idle, or the queue the piece goes to is empty.
+ */
+bool _tp_range_demand(thread_pool_t *tp)
 {
-    pthread_mutex_lock(&tp->lock);
+    tp_worker_t *self = g_worker;
 
-    do {
-        pthread_cond_wait(&tp->no_task, &tp->lock);
-    } while (tp->active_tasks > 0);
+    if (__atomic_load_n(&tp->nidle, __ATOMIC_RELAXED) > 0) {
+        return true;
+    }
 
-    pthread_mutex_unlock(&tp->lock);
+    if (self && self->pool == tp && tp->attr.sched == TP_SCHED_STEALING) {
+        return deque_isempty(&self->deque);
+    }
 
-    return tp->active_tasks == 0;
+    return tp_queue_len(tp) == 0;
 }
 
 
-bool tp_post_task(thread_pool_t *tp, tp_task_t *task)
+void *_tp_range_task(void *args);
+
+
+/**
+ * Post [begin, end) as a piece of the job.
+ */
+bool _tp_range_split(tp_range_job_t *job, uint64_t begin, uint64_t end)
 {
     bool status = false;
-    bool posted = false;
-    qdata_t data;
+    tp_range_piece_t piece;
+    tp_task_t *task;
 
-    if (tp == NULL || task == NULL) {
-        goto EXIT;
-    }
+    piece.job = job;
+    piece.begin = begin;
+    piece.end = end;
 
-    // todo: check return value?
-    data.ptr = task;
-    pthread_mutex_lock(&tp->lock);
-    posted = queue_enqueue(&tp->task_queue, data);
-    pthread_mutex_unlock(&tp->lock);
+    task = tp_task_create_pooled(job->tp, _tp_range_task, NULL, &piece, sizeof(piece));
 
-    if (!posted) {
+    if (task == NULL) {
         goto EXIT;
     }
 
-    __sync_add_and_fetch(&tp->active_tasks, 1);
-    __sync_synchronize();
-
-    pthread_cond_signal(&tp->has_task);
+    if (!tp_group_post(job->tp, &job->group, task)) {
+        tp_task_free(task);
+        goto EXIT;
+    }
 
     status = true;
 
@@ -274,182 +3336,209 @@ EXIT:
 }
 
 
-int tp_post_tasks(thread_pool_t *tp, tp_task_t *tasks[], int ntask)
+/**
+ * Run [begin, end) grain by grain. Before each grain, the upper half of
+ * what's left is split off while other threads are short of work, so
+ * a range is only cut as much as the idle threads can take.
+ */
+void _tp_range_run(tp_range_job_t *job, uint64_t begin, uint64_t end)
 {
-    int i;
-    int posted = 0;
-    qdata_t data;
-
-    if (tp == NULL || tasks == NULL || ntask == 0) {
-        goto EXIT;
+    uint64_t mid;
+    void *acc = NULL;
+    // accumulator of tp_parallel_reduce(), allocated when it doesn't fit
+    union
+    {
+        char buf[TP_TASK_INLINE_ARGS];
+        void *align_ptr;
+        uint64_t align_u64;
+        long double align_ld;
+    } local;
+
+    if (job->map) {
+        acc = job->size <= sizeof(local) ? local.buf : malloc(job->size);
+
+        if (acc == NULL) {
+            // Accumulate into the result directly, one grain at a time
+            perror("failed to allocate accumulator");
+        } else {
+            memcpy(acc, job->identity, job->size);
+        }
     }
 
-    pthread_mutex_lock(&tp->lock);
-    for (i = 0; i < ntask; ++i) {
-        data.ptr = tasks[i];
-        if (queue_enqueue(&tp->task_queue, data)) {
-            ++posted;
+    while (begin < end) {
+        if (end - begin > job->grain && _tp_range_demand(job->tp)) {
+            mid = begin + (end - begin) / 2;
+
+            if (_tp_range_split(job, mid, end)) {
+                end = mid;
+                continue;
+            }
         }
-    }
-    pthread_mutex_unlock(&tp->lock);
 
-    if (posted) {
-        __sync_add_and_fetch(&tp->active_tasks, ntask);
-        __sync_synchronize();
+        mid = end - begin > job->grain ? begin + job->grain : end;
+
+        if (job->fn) {
+            job->fn(job->ctx, begin, mid);
+        } else if (acc) {
+            job->map(job->ctx, begin, mid, acc);
+        } else {
+            pthread_spin_lock(&job->lock);
+            job->map(job->ctx, begin, mid, job->result);
+            pthread_spin_unlock(&job->lock);
+        }
 
-        pthread_cond_signal(&tp->has_task);
+        begin = mid;
     }
 
-EXIT:
-    return posted;
+    if (acc) {
+        pthread_spin_lock(&job->lock);
+        job->combine(job->ctx, job->result, acc);
+        pthread_spin_unlock(&job->lock);
+
+        if (acc != local.buf) {
+            free(acc);
+        }
+    }
 }
 
 
-void tp_cleanup_unlock(void *args)
+void *_tp_range_task(void *args)
 {
-    thread_pool_t *pool = args;
+    tp_range_piece_t *piece = args;
 
-    pthread_mutex_unlock(&pool->lock);
-}
+    _tp_range_run(piece->job, piece->begin, piece->end);
 
-
-void tp_cleanup(void *args)
-{
-    UNUSED_PARAM(args);
-//    fprintf(stderr, "thread ended\n");
+    return NULL;
 }
 
 
-void *tp_worker(void *args)
+/**
+ * Run the job over [begin, end) with the calling thread taking part,
+ * and wait for the pieces posted meanwhile.
+ */
+bool _tp_range_job(tp_range_job_t *job, uint64_t begin, uint64_t end)
 {
-    qdata_t data;
-    thread_pool_t *pool = args;
-    tp_task_t *task = NULL;
+    bool status = false;
+    uint64_t threads;
 
-    pthread_cleanup_push(tp_cleanup, pool) ;
+    if (job->tp == NULL || begin > end) {
+        goto EXIT;
+    }
 
-            while (1) {
-                data.ptr = NULL;
-                task = NULL;
+    if (pthread_spin_init(&job->lock, PTHREAD_PROCESS_PRIVATE)) {
+        perror("pthread_spin_init() failed");
+        goto EXIT;
+    }
 
-                // Take a task
-                pthread_mutex_lock(&pool->lock);
+    // A few pieces per thread, so the late ones can be balanced
+    if (job->grain == 0) {
+        threads = tp_live_threads(job->tp) + 1;
+        job->grain = (end - begin) / (threads * TP_PARALLEL_PIECES);
 
-                pthread_cleanup_push(tp_cleanup_unlock, pool) ;
-                        // If no task in queue, wait until someone post one.
-                        while (queue_isempty(&pool->task_queue)) {
-                            pthread_cond_wait(&pool->has_task, &pool->lock);
-                        }
-                        // Dequeue a task for running
-                        if (queue_dequeue(&pool->task_queue, &data)) {
-                            task = data.ptr;
-                        }
+        if (job->grain == 0) {
+            job->grain = 1;
+        }
+    }
 
-                pthread_cleanup_pop(0);
+    tp_group_init(&job->group);
+    _tp_range_run(job, begin, end);
 
-                pthread_mutex_unlock(&pool->lock);
+    // Runs the queued pieces as well, so it works without workers too
+    tp_group_wait(job->tp, &job->group, true);
 
-                // Run a task
-                if (task && task->runner) {
-                    if (task->cleanup) {
-                        pthread_cleanup_push(task->cleanup, task->args) ;
-                                task->runner(task->args);
-                        pthread_cleanup_pop(0);
-                        task->cleanup(task->args);
-                    } else {
-                        task->runner(task->args);
-                    }
+    if (pthread_spin_destroy(&job->lock)) {
+        perror("pthread_spin_destroy() failed");
+    }
 
+    status = true;
 
-                    // Note: pool->task_queue is empty DO NOT means there is no task
-                    //
-                    // If there is no task remain in the queue after dequeue operation,
-                    // signal for tp_join_task()
-                    if (__sync_sub_and_fetch(&pool->active_tasks, 1) == 0) {
-                        pthread_cond_signal(&pool->no_task);
-                    }
+EXIT:
+    return status;
+}
 
-                    tp_task_free(task);
-                    task = NULL;
-                }
-            }
 
-    pthread_cleanup_pop(0);
+bool tp_parallel_for(thread_pool_t *tp, uint64_t begin, uint64_t end, uint64_t grain,
+                     tp_range_fn_t fn, void *ctx)
+{
+    tp_range_job_t job;
 
-    return NULL;
-}
+    if (fn == NULL) {
+        return false;
+    }
 
+    bzero(&job, sizeof(job));
+    job.tp = tp;
+    job.grain = grain;
+    job.ctx = ctx;
+    job.fn = fn;
 
-/* ---------------- Thread Pool Self API ---------------- */
+    return _tp_range_job(&job, begin, end);
+}
 
 
-void *_tp_self_create(void *args)
+bool tp_parallel_reduce(thread_pool_t *tp, uint64_t begin, uint64_t end, uint64_t grain,
+                        tp_reduce_fn_t map, tp_combine_fn_t combine,
+                        const void *identity, size_t size, void *result, void *ctx)
 {
-    tp_self_arg *arg = NULL;
-
-    arg = malloc(sizeof(tp_self_arg));
+    tp_range_job_t job;
 
-    if (arg) {
-        arg->tp = args;
+    if (map == NULL || combine == NULL || identity == NULL || size == 0 || result == NULL) {
+        return false;
     }
 
-    return arg;
-}
-
+    bzero(&job, sizeof(job));
+    job.tp = tp;
+    job.grain = grain;
+    job.ctx = ctx;
+    job.map = map;
+    job.combine = combine;
+    job.identity = identity;
+    job.size = size;
+    job.result = result;
 
-#define _tp_self_cleanup free
+    memcpy(result, identity, size);
 
+    return _tp_range_job(&job, begin, end);
+}
 
-void _tp_self_key_init(thread_pool_t *tp)
-{
-    tp_task_t *task;
 
-    // pass `tp` to it directly without copying by setting
-    // args_len to 0.
-    task = tp_task_create(_tp_self_create, _tp_self_cleanup, tp, 0);
+/* ---------------- Thread Pool Self API ---------------- */
 
-    if (!task) {
-        goto EXIT;
-    }
 
-    if (!tp_tls_init(&g_self_tls, task)) {
-        goto EXIT;
-    }
+thread_pool_t *tp_self()
+{
+    return g_worker ? g_worker->pool : g_self;
+}
 
 
-    if (!tp_set_tls(&g_self_tls)) {
-        goto EXIT;
-    }
+tp_worker_t *tp_self_worker()
+{
+    return g_worker;
+}
 
-    g_self_key_inited = true;
 
-EXIT:
-    return;
-}
+/* ---------------- Arena API ---------------- */
 
 
-void _tp_self_destroy(thread_pool_t *tp)
+void *tp_arena_alloc(size_t size)
 {
-    UNUSED_PARAM(tp);
+    tp_worker_t *self = g_worker;
 
-    if (g_self_key_inited) {
-        tp_tls_destroy(&g_self_tls);
+    if (self == NULL) {
+        return NULL;
     }
+
+    return arena_alloc(&self->arena, size);
 }
 
 
-thread_pool_t *tp_self()
+void tp_arena_reset()
 {
+    tp_worker_t *self = g_worker;
 
-    tp_self_arg *arg = NULL;
-    thread_pool_t *pool = NULL;
-
-    if (g_self_key_inited) {
-        arg = tp_get_tls(&g_self_tls);
-        pool = arg->tp;
+    if (self) {
+        arena_reset(&self->arena);
     }
-
-    return pool;
 }
 
 
@@ -559,6 +3648,206 @@ EXIT:
 }
 
 
+/* ---------------- Task Slab ---------------- */
+
+
+/**
+ * Allocate a new slab and put all its tasks to the shared free list
+ * of `node`. The caller runs on that node, and linking the tasks
+ * touches their pages first, so they're placed on it.
+ * `slab_lock` must be held.
+ */
+bool _tp_slab_grow(thread_pool_t *tp, uint32_t node)
+{
+    int i;
+    tp_slab_t *slab;
+
+    slab = malloc(sizeof(tp_slab_t));
+
+    if (slab == NULL) {
+        return false;
+    }
+
+    for (i = TP_SLAB_TASKS - 1; i >= 0; --i) {
+        slab->tasks[i].slab_node = node;
+        slab->tasks[i].next = tp->free_tasks[node];
+        tp->free_tasks[node] = &slab->tasks[i];
+    }
+
+    slab->next = tp->slabs;
+    tp->slabs = slab;
+    ++tp->task_stats.slabs;
+
+    return true;
+}
+
+
+void _tp_slab_destroy(thread_pool_t *tp)
+{
+    uint32_t i;
+    tp_slab_t *slab;
+
+    while (tp->slabs) {
+        slab = tp->slabs;
+        tp->slabs = slab->next;
+        free(slab);
+    }
+
+    for (i = 0; i < tp->nnode; ++i) {
+        tp->free_tasks[i] = NULL;
+    }
+}
+
+
+tp_task_t *_tp_task_get(thread_pool_t *tp)
+{
+    int i;
+    uint32_t node;
+    tp_task_t **free_tasks;
+    tp_task_t *task = NULL;
+    tp_worker_t *self = g_worker;
+
+    if (self && self->pool == tp) {
+        if (self->task_cache) {
+            task = self->task_cache;
+            self->task_cache = task->next;
+            --self->ntask_cache;
+            ++self->task_cache_hits;
+            goto EXIT;
+        }
+    } else {
+        self = NULL;
+    }
+
+    node = self ? self->node : _tp_current_node(tp);
+    free_tasks = &tp->free_tasks[node];
+
+    pthread_mutex_lock(&tp->slab_lock);
+
+    if (*free_tasks) {
+        ++tp->task_stats.shared_hits;
+    } else if (_tp_slab_grow(tp, node)) {
+        ++tp->task_stats.misses;
+    } else {
+        goto UNLOCK;
+    }
+
+    task = *free_tasks;
+    *free_tasks = task->next;
+
+    // Refill the private cache, so next allocations don't lock
+    if (self) {
+        for (i = 0; i < TP_TASK_CACHE_BATCH && *free_tasks; ++i) {
+            tp_task_t *t = *free_tasks;
+
+            *free_tasks = t->next;
+            t->next = self->task_cache;
+            self->task_cache = t;
+            ++self->ntask_cache;
+        }
+    }
+
+UNLOCK:
+    pthread_mutex_unlock(&tp->slab_lock);
+
+EXIT:
+    return task;
+}
+
+
+/**
+ * Give a pooled task back to the free list of `node`, the node of its
+ * slab, which tp_task_destroy() has wiped from the task.
+ */
+void _tp_task_put(thread_pool_t *tp, tp_task_t *task, uint32_t node)
+{
+    int i;
+    tp_task_t *head;
+    tp_task_t *tail;
+    tp_worker_t *self = g_worker;
+
+    task->slab_node = node;
+
+    // Tasks of other nodes go back to their own node
+    if (self && self->pool == tp && node == self->node) {
+        task->next = self->task_cache;
+        self->task_cache = task;
+        ++self->ntask_cache;
+        ++self->task_cache_frees;
+
+        if (self->ntask_cache <= TP_TASK_CACHE_MAX) {
+            return;
+        }
+
+        // Give a batch back, workers freeing tasks posted by
+        // other threads would hoard them otherwise
+        head = self->task_cache;
+        tail = head;
+
+        for (i = 1; i < TP_TASK_CACHE_MAX / 2; ++i) {
+            tail = tail->next;
+        }
+
+        self->task_cache = tail->next;
+        self->ntask_cache -= TP_TASK_CACHE_MAX / 2;
+
+        pthread_mutex_lock(&tp->slab_lock);
+        tail->next = tp->free_tasks[self->node];
+        tp->free_tasks[self->node] = head;
+        pthread_mutex_unlock(&tp->slab_lock);
+
+        return;
+    }
+
+    pthread_mutex_lock(&tp->slab_lock);
+    task->next = tp->free_tasks[node];
+    tp->free_tasks[node] = task;
+    ++tp->task_stats.remote_frees;
+    pthread_mutex_unlock(&tp->slab_lock);
+}
+
+
+/**
+ * Give the private cache of a retiring worker back to the shared list.
+ */
+void _tp_task_cache_flush(thread_pool_t *tp, tp_worker_t *worker)
+{
+    tp_task_t *task;
+
+    if (worker->task_cache == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&tp->slab_lock);
+
+    while (worker->task_cache) {
+        task = worker->task_cache;
+        worker->task_cache = task->next;
+        task->next = tp->free_tasks[worker->node];
+        tp->free_tasks[worker->node] = task;
+    }
+
+    worker->ntask_cache = 0;
+
+    pthread_mutex_unlock(&tp->slab_lock);
+}
+
+
+void tp_task_stats(thread_pool_t *tp, tp_task_stats_t *stats)
+{
+    uint32_t i;
+
+    pthread_mutex_lock(&tp->slab_lock);
+    *stats = tp->task_stats;
+    pthread_mutex_unlock(&tp->slab_lock);
+
+    for (i = 0; i < tp->nthread; ++i) {
+        stats->local_hits += __atomic_load_n(&tp->workers[i].task_cache_hits, __ATOMIC_RELAXED);
+        stats->local_frees += __atomic_load_n(&tp->workers[i].task_cache_frees, __ATOMIC_RELAXED);
+    }
+}
+
+
 /* ---------------- Task API ---------------- */
 
 
@@ -580,7 +3869,11 @@ bool tp_task_init(tp_task_t *task,
         if (args_len == 0) {
             _args = args;
         } else {
-            _args = malloc(args_len);
+            if (args_len <= TP_TASK_INLINE_ARGS) {
+                _args = task->inline_args.buf;
+            } else {
+                _args = malloc(args_len);
+            }
 
             if (!_args) {
                 goto EXIT;
@@ -594,6 +3887,22 @@ bool tp_task_init(tp_task_t *task,
     task->cleanup = cleanup;
     task->args = _args;
     task->args_len = args_len;
+    task->next = NULL;
+    task->owner = NULL;
+    task->future = NULL;
+    task->group = NULL;
+    task->priority = TP_PRIORITY_NORMAL;
+    task->due_ns = 0;
+    task->interval_ns = 0;
+    task->cancelled = 0;
+    task->node = TP_NODE_ANY;
+    task->deps = 1;
+    task->dep_cancelled = 0;
+    task->dep_pool = NULL;
+    task->succ = NULL;
+    task->nsucc = 0;
+    task->handoff = NULL;
+    task->handoff_runner = NULL;
     status = true;
 
 EXIT:
@@ -604,9 +3913,23 @@ EXIT:
 void tp_task_destroy(tp_task_t *task)
 {
     if (task) {
+        // Destroyed without being run
+        if (task->future) {
+            _tp_future_complete(task->future, TP_FUTURE_CANCELLED, NULL);
+        }
+
+        if (task->group) {
+            tp_group_done(task->group);
+        }
+
+        if (task->nsucc) {
+            _tp_deps_cancel(task);
+        }
+
         // if args_len == 0 then don't free
-        // cause it didn't be allocated
-        if (task->args && task->args_len) {
+        // cause it didn't be allocated, neither the inline ones
+        if (task->args && task->args_len
+            && task->args != (void *) task->inline_args.buf) {
             free(task->args);
         }
 
@@ -622,7 +3945,10 @@ tp_task_t *tp_task_create(runnable_t runner, cleanup_t cleanup,
 
     task = malloc(sizeof(tp_task_t));
 
-    tp_task_init(task, runner, cleanup, args, args_len);
+    if (task && !tp_task_init(task, runner, cleanup, args, args_len)) {
+        free(task);
+        task = NULL;
+    }
 
     return task;
 }
@@ -630,10 +3956,54 @@ tp_task_t *tp_task_create(runnable_t runner, cleanup_t cleanup,
 
 void tp_task_free(tp_task_t *task)
 {
+    thread_pool_t *owner;
+    uint32_t node;
+
     if (task) {
+        owner = task->owner;
+        node = task->slab_node;
+
         tp_task_destroy(task);
 
-        free(task);
+        if (owner) {
+            _tp_task_put(owner, task, node);
+        } else {
+            free(task);
+        }
+    }
+}
+
+
+tp_task_t *tp_task_create_pooled(thread_pool_t *tp, runnable_t runner,
+                                 cleanup_t cleanup, void *args, size_t args_len)
+{
+    tp_task_t *task = NULL;
+
+    if (tp == NULL) {
+        goto EXIT;
+    }
+
+    task = _tp_task_get(tp);
+
+    if (task == NULL) {
+        goto EXIT;
+    }
+
+    if (!tp_task_init(task, runner, cleanup, args, args_len)) {
+        _tp_task_put(tp, task, task->slab_node);
+        task = NULL;
+        goto EXIT;
     }
+
+    task->owner = tp;
+
+EXIT:
+    return task;
+}
+
+
+void tp_task_free_pooled(tp_task_t *task)
+{
+    tp_task_free(task);
 }
 
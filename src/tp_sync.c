@@ -0,0 +1,85 @@
+#include "tp_sync.h"
+
+#include <errno.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#endif
+
+
+// poll interval when futex is not available
+#define TP_SYNC_POLL_NS 50000
+
+
+uint64_t tp_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+
+#ifdef __linux__
+
+
+bool tp_sync_wait(uint32_t *addr, uint32_t expected, uint64_t timeout_ns)
+{
+    struct timespec ts;
+    struct timespec *pts = NULL;
+
+    if (timeout_ns != TP_SYNC_INFINITE) {
+        ts.tv_sec = (time_t) (timeout_ns / 1000000000ull);
+        ts.tv_nsec = (long) (timeout_ns % 1000000000ull);
+        pts = &ts;
+    }
+
+    // FUTEX_WAIT takes a relative CLOCK_MONOTONIC timeout
+    if (syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, pts, NULL, 0) == -1) {
+        return errno != ETIMEDOUT;
+    }
+
+    return true;
+}
+
+
+void tp_sync_wake(uint32_t *addr, int n)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+
+#else
+
+
+bool tp_sync_wait(uint32_t *addr, uint32_t expected, uint64_t timeout_ns)
+{
+    struct timespec ts;
+    uint64_t ns = timeout_ns < TP_SYNC_POLL_NS ? timeout_ns : TP_SYNC_POLL_NS;
+
+    if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != expected) {
+        return true;
+    }
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = (long) ns;
+    nanosleep(&ts, NULL);
+
+    return ns == TP_SYNC_POLL_NS || __atomic_load_n(addr, __ATOMIC_ACQUIRE) != expected;
+}
+
+
+void tp_sync_wake(uint32_t *addr, int n)
+{
+    (void) addr;
+    (void) n;
+}
+
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef TP_SYNC_H
+#define TP_SYNC_H
+
+/**
+ * Private low level synchronization helpers of the pool:
+ * futex based waiting on a 32-bit word and a monotonic clock.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// wait forever in tp_sync_wait()
+#define TP_SYNC_INFINITE UINT64_MAX
+
+// Thread local storage of the library. It's built as a shared library,
+// where plain __thread goes through __tls_get_addr() on every access,
+// initial-exec makes it a single load off the thread pointer
+#define TP_TLS __thread __attribute__((tls_model("initial-exec")))
+
+
+/**
+ * Block while `*addr == expected`, at most `timeout_ns` nanoseconds.
+ * May return spuriously, callers must check the word again.
+ *
+ * @return false: timed out
+ *         true: woken up, spurious wakeup or `*addr != expected`
+ */
+bool tp_sync_wait(uint32_t *addr, uint32_t expected, uint64_t timeout_ns);
+
+/**
+ * Wake up at most `n` threads blocked on `addr`.
+ */
+void tp_sync_wake(uint32_t *addr, int n);
+
+/**
+ * Wake up all threads blocked on `addr`.
+ */
+#define tp_sync_wake_all(addr) tp_sync_wake((addr), 0x7fffffff)
+
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t tp_now_ns(void);
+
+/**
+ * Hint the CPU that we're spinning.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define tp_cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#elif defined(__aarch64__)
+#define tp_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define tp_cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+
+#endif //TP_SYNC_H
@@ -0,0 +1,215 @@
+#include "tp_topo.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+
+#define TP_TOPO_NODE_DIR "/sys/devices/system/node"
+
+
+/**
+ * Read the first line of a small sysfs file.
+ */
+bool _tp_topo_read(const char *path, char *buf, int size)
+{
+    bool status = false;
+    FILE *fp = fopen(path, "r");
+
+    if (fp == NULL) {
+        goto EXIT;
+    }
+
+    status = fgets(buf, size, fp) != NULL;
+
+    fclose(fp);
+
+EXIT:
+    return status;
+}
+
+
+bool tp_topo_parse_list(const char *list, cpu_set_t *set)
+{
+    long lo;
+    long hi;
+    char *end;
+    const char *p = list;
+
+    CPU_ZERO(set);
+
+    while (*p && *p != '\n') {
+        lo = strtol(p, &end, 10);
+
+        if (end == p || lo < 0) {
+            return false;
+        }
+
+        hi = lo;
+        p = end;
+
+        if (*p == '-') {
+            ++p;
+            hi = strtol(p, &end, 10);
+
+            if (end == p || hi < lo) {
+                return false;
+            }
+
+            p = end;
+        }
+
+        if (hi >= CPU_SETSIZE) {
+            return false;
+        }
+
+        for (; lo <= hi; ++lo) {
+            CPU_SET(lo, set);
+        }
+
+        if (*p == ',') {
+            ++p;
+        } else if (*p && *p != '\n') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool tp_topo_load(tp_topo_t *topo)
+{
+    bool status = false;
+    int id;
+    int cpu;
+    int count;
+    char path[64];
+    char buf[4096];
+    cpu_set_t online;
+    cpu_set_t cpus;
+
+    bzero(topo, sizeof(tp_topo_t));
+
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &topo->allowed)) {
+        perror("sched_getaffinity() failed");
+        goto EXIT;
+    }
+
+    // Node ids are listed the same way as CPUs
+    if (!_tp_topo_read(TP_TOPO_NODE_DIR "/online", buf, sizeof(buf))
+        || !tp_topo_parse_list(buf, &online)) {
+        CPU_ZERO(&online);
+    }
+
+    count = CPU_COUNT(&online);
+    topo->node_ids = calloc(count > 0 ? count : 1, sizeof(int));
+    topo->node_cpus = calloc(count > 0 ? count : 1, sizeof(cpu_set_t));
+
+    if (topo->node_ids == NULL || topo->node_cpus == NULL) {
+        perror("failed to allocate topology");
+        goto EXIT;
+    }
+
+    for (id = 0; id < CPU_SETSIZE && count > 0; ++id) {
+        if (!CPU_ISSET(id, &online)) {
+            continue;
+        }
+
+        --count;
+        sprintf(path, TP_TOPO_NODE_DIR "/node%d/cpulist", id);
+
+        if (!_tp_topo_read(path, buf, sizeof(buf)) || !tp_topo_parse_list(buf, &cpus)) {
+            continue;
+        }
+
+        CPU_AND(&cpus, &cpus, &topo->allowed);
+
+        if (CPU_COUNT(&cpus) == 0) {
+            continue;
+        }
+
+        topo->node_ids[topo->nnode] = id;
+        topo->node_cpus[topo->nnode] = cpus;
+        ++topo->nnode;
+    }
+
+    if (topo->nnode == 0) {
+        topo->node_ids[0] = 0;
+        topo->node_cpus[0] = topo->allowed;
+        topo->nnode = 1;
+    }
+
+    for (id = 0; id < (int) topo->nnode; ++id) {
+        for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &topo->node_cpus[id])) {
+                topo->cpu_node[cpu] = (uint16_t) id;
+            }
+        }
+    }
+
+    status = true;
+
+EXIT:
+    if (!status) {
+        tp_topo_destroy(topo);
+    }
+
+    return status;
+}
+
+
+void tp_topo_destroy(tp_topo_t *topo)
+{
+    if (topo) {
+        free(topo->node_ids);
+        free(topo->node_cpus);
+
+        bzero(topo, sizeof(tp_topo_t));
+    }
+}
+
+
+uint32_t tp_topo_node_of(tp_topo_t *topo, int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return 0;
+    }
+
+    return topo->cpu_node[cpu];
+}
+
+
+uint32_t tp_topo_find_node(tp_topo_t *topo, int id)
+{
+    uint32_t i;
+
+    for (i = 0; i < topo->nnode; ++i) {
+        if (topo->node_ids[i] == id) {
+            return i;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+
+int tp_topo_nth_cpu(const cpu_set_t *set, uint32_t n)
+{
+    int cpu;
+    int count = CPU_COUNT(set);
+
+    if (count == 0) {
+        return -1;
+    }
+
+    n %= (uint32_t) count;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, set) && n-- == 0) {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
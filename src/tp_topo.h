@@ -0,0 +1,67 @@
+#ifndef TP_TOPO_H
+#define TP_TOPO_H
+
+/**
+ * Private CPU topology helpers of the pool: the NUMA layout is read
+ * from sysfs, so there is no dependency on libnuma. Linux only.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "thread_pool.h"
+
+
+struct tp_topo_s
+{
+    // CPUs the process may run on
+    cpu_set_t allowed;
+    // nodes having any allowed CPU, memory-only nodes are left out
+    uint32_t nnode;
+    int *node_ids;
+    cpu_set_t *node_cpus;
+    // index in `node_ids` of the node of each CPU
+    uint16_t cpu_node[CPU_SETSIZE];
+};
+
+
+/**
+ * Read the topology. Without sysfs all allowed CPUs make one node.
+ *
+ * @return true: succeed
+ *         false: failed
+ */
+bool tp_topo_load(tp_topo_t *topo);
+
+void tp_topo_destroy(tp_topo_t *topo);
+
+/**
+ * Parse a sysfs CPU list like "0-3,8,10-11".
+ *
+ * @return true: succeed
+ *         false: malformed list
+ */
+bool tp_topo_parse_list(const char *list, cpu_set_t *set);
+
+/**
+ * Index of the node of a CPU, 0 when unknown.
+ */
+uint32_t tp_topo_node_of(tp_topo_t *topo, int cpu);
+
+/**
+ * Index of the node with the given OS id, UINT32_MAX if there is none.
+ */
+uint32_t tp_topo_find_node(tp_topo_t *topo, int id);
+
+/**
+ * The n-th CPU of a set, wrapping around, -1 if it's empty.
+ */
+int tp_topo_nth_cpu(const cpu_set_t *set, uint32_t n);
+
+
+#endif //TP_TOPO_H
@@ -0,0 +1,301 @@
+// syscall()
+#define _GNU_SOURCE
+
+#include "tp_trace.h"
+#include "tp_sync.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+// Ring of the calling thread in the pool it last recorded into
+static TP_TLS tp_trace_buf_t *g_trace_buf = NULL;
+static TP_TLS uint32_t g_trace_id = 0;
+
+// Source of `trace_id`, 0 is never used
+static uint32_t g_trace_ids = 0;
+
+// Indexed by tp_trace_kind_t
+static const char *g_trace_names[] = {"post", "run", "run", "park", "park"};
+static const char *g_trace_phases[] = {"i", "B", "E", "B", "E"};
+
+
+/**
+ * Allocate a ring of `attr.trace_events` events, rounded up to a power of 2.
+ */
+tp_trace_buf_t *_tp_trace_buf_create(thread_pool_t *tp, pid_t tid, uint32_t worker)
+{
+    uint32_t capacity = 1;
+    tp_trace_buf_t *buf = calloc(1, sizeof(tp_trace_buf_t));
+
+    if (buf == NULL) {
+        perror("failed to allocate trace buffer");
+        goto EXIT;
+    }
+
+    while (capacity < tp->attr.trace_events) {
+        capacity <<= 1;
+    }
+
+    buf->events = calloc(capacity, sizeof(tp_trace_event_t));
+
+    if (buf->events == NULL) {
+        perror("failed to allocate trace events");
+        free(buf);
+        buf = NULL;
+        goto EXIT;
+    }
+
+    buf->tid = tid;
+    buf->worker = worker;
+    buf->mask = capacity - 1;
+
+EXIT:
+    return buf;
+}
+
+
+/**
+ * Find or create the ring of the calling thread, and cache it.
+ */
+tp_trace_buf_t *_tp_trace_buf(thread_pool_t *tp, tp_worker_t *self)
+{
+    pid_t tid = (pid_t) syscall(SYS_gettid);
+    tp_trace_buf_t *buf = NULL;
+
+    if (self && self->pool != tp) {
+        self = NULL;
+    }
+
+    if (self && self->trace) {
+        // A worker started in the slot of a retired one carries on its ring
+        buf = self->trace;
+        buf->tid = tid;
+        goto EXIT;
+    }
+
+    if (self == NULL) {
+        for (buf = __atomic_load_n(&tp->trace_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+            if (buf->tid == tid && buf->worker == UINT32_MAX) {
+                goto EXIT;
+            }
+        }
+    }
+
+    buf = _tp_trace_buf_create(tp, tid, self ? self->index : UINT32_MAX);
+
+    if (buf == NULL) {
+        goto EXIT;
+    }
+
+    if (self) {
+        self->trace = buf;
+    }
+
+    buf->next = __atomic_load_n(&tp->trace_bufs, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&tp->trace_bufs, &buf->next, buf, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+
+EXIT:
+    if (buf) {
+        g_trace_buf = buf;
+        g_trace_id = tp->trace_id;
+    }
+
+    return buf;
+}
+
+
+void tp_trace_record(thread_pool_t *tp, tp_worker_t *self, tp_trace_kind_t kind, const void *task)
+{
+    uint64_t head;
+    tp_trace_event_t *event;
+    tp_trace_buf_t *buf = g_trace_buf;
+
+    if (buf == NULL || g_trace_id != tp->trace_id) {
+        buf = _tp_trace_buf(tp, self);
+
+        if (buf == NULL) {
+            return;
+        }
+    }
+
+    // Only the owner writes `head`
+    head = buf->head;
+    event = &buf->events[head & buf->mask];
+    event->ts_ns = tp_now_ns();
+    event->task = (uint64_t) (uintptr_t) task;
+    event->kind = kind;
+
+    // Publishes the event to tp_trace_dump()
+    __atomic_store_n(&buf->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+void tp_trace_destroy(thread_pool_t *tp)
+{
+    tp_trace_buf_t *buf;
+
+    while ((buf = tp->trace_bufs) != NULL) {
+        tp->trace_bufs = buf->next;
+        free(buf->events);
+        free(buf);
+    }
+}
+
+
+/* ---------------- Trace API ---------------- */
+
+
+bool tp_trace_start(thread_pool_t *tp)
+{
+    bool status = false;
+
+#ifndef TP_TRACE
+    goto EXIT;
+#endif
+
+    if (tp == NULL) {
+        goto EXIT;
+    }
+
+    if (tp->trace_id == 0) {
+        tp->trace_id = __sync_add_and_fetch(&g_trace_ids, 1);
+    }
+
+    tp->trace_start_ns = tp_now_ns();
+    __atomic_store_n(&tp->tracing, 1, __ATOMIC_RELEASE);
+
+    status = true;
+
+EXIT:
+    return status;
+}
+
+
+void tp_trace_stop(thread_pool_t *tp)
+{
+    if (tp) {
+        __atomic_store_n(&tp->tracing, 0, __ATOMIC_RELEASE);
+    }
+}
+
+
+/**
+ * Write one event of the Chrome trace event format, and the flow
+ * event linking the post of a task to its start.
+ */
+void _tp_trace_write(FILE *out, int pid, int tid, uint64_t base_ns, const tp_trace_event_t *event)
+{
+    double ts = (double) (event->ts_ns - base_ns) / 1000.0;
+    unsigned long long task = (unsigned long long) event->task;
+
+    if (event->kind == TP_TRACE_POST) {
+        fprintf(out, ",\n{\"name\": \"task\", \"cat\": \"task\", \"ph\": \"s\", \"id\": \"0x%llx\", "
+                     "\"ts\": %.3f, \"pid\": %d, \"tid\": %d}", task, ts, pid, tid);
+    } else if (event->kind == TP_TRACE_START) {
+        fprintf(out, ",\n{\"name\": \"task\", \"cat\": \"task\", \"ph\": \"f\", \"bp\": \"e\", "
+                     "\"id\": \"0x%llx\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}", task, ts, pid, tid);
+    }
+
+    fprintf(out, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"%s\", ",
+            g_trace_names[event->kind], event->task ? "task" : "worker", g_trace_phases[event->kind]);
+
+    if (event->kind == TP_TRACE_POST) {
+        fprintf(out, "\"s\": \"t\", ");
+    }
+
+    fprintf(out, "\"ts\": %.3f, \"pid\": %d, \"tid\": %d", ts, pid, tid);
+
+    if (event->task) {
+        fprintf(out, ", \"args\": {\"task\": \"0x%llx\"}", task);
+    }
+
+    fprintf(out, "}");
+}
+
+
+bool tp_trace_dump(thread_pool_t *tp, FILE *out)
+{
+    bool status = false;
+    int pid = (int) getpid();
+    uint32_t capacity = 1;
+    uint64_t i;
+    uint64_t head;
+    uint64_t start;
+    uint64_t first;
+    uint64_t base_ns;
+    tp_trace_buf_t *buf;
+    tp_trace_event_t *event;
+    tp_trace_event_t *events = NULL;
+
+#ifndef TP_TRACE
+    goto EXIT;
+#endif
+
+    if (tp == NULL || out == NULL) {
+        goto EXIT;
+    }
+
+    while (capacity < tp->attr.trace_events) {
+        capacity <<= 1;
+    }
+
+    events = malloc(capacity * sizeof(tp_trace_event_t));
+
+    if (events == NULL) {
+        perror("failed to allocate trace events");
+        goto EXIT;
+    }
+
+    base_ns = tp->trace_start_ns;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"
+                 "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+                 "\"args\": {\"name\": \"thread pool %p\"}}", pid, (void *) tp);
+
+    for (buf = __atomic_load_n(&tp->trace_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+        start = head > buf->mask ? head - buf->mask - 1 : 0;
+
+        for (i = start; i < head; ++i) {
+            events[i - start] = buf->events[i & buf->mask];
+        }
+
+        // The owner went on meanwhile, the slots it reached may be torn
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        i = __atomic_load_n(&buf->head, __ATOMIC_RELAXED);
+        first = start;
+
+        if (i > buf->mask && i - buf->mask > first) {
+            first = i - buf->mask;
+        }
+
+        if (buf->worker != UINT32_MAX) {
+            fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                         "\"args\": {\"name\": \"worker %u\"}}", pid, (int) buf->tid, buf->worker);
+        } else {
+            fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                         "\"args\": {\"name\": \"thread %d\"}}", pid, (int) buf->tid, (int) buf->tid);
+        }
+
+        for (i = first; i < head; ++i) {
+            event = &events[i - start];
+
+            if (event->ts_ns >= base_ns) {
+                _tp_trace_write(out, pid, (int) buf->tid, base_ns, event);
+            }
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    status = !ferror(out);
+
+EXIT:
+    free(events);
+
+    return status;
+}
@@ -0,0 +1,68 @@
+#ifndef TP_TRACE_H
+#define TP_TRACE_H
+
+/**
+ * Private event tracing of the pool. Each thread owns a ring which it
+ * writes without locks, readers copy it and leave out the events which
+ * were overwritten meanwhile.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "thread_pool.h"
+
+
+typedef struct tp_trace_event_s tp_trace_event_t;
+
+
+struct tp_trace_event_s
+{
+    // CLOCK_MONOTONIC
+    uint64_t ts_ns;
+    // address of the task, also the id linking its post to its start
+    uint64_t task;
+    // tp_trace_kind_t
+    uint32_t kind;
+};
+
+
+struct tp_trace_buf_s
+{
+    tp_trace_buf_t *next;
+    // kernel thread id of the owner
+    pid_t tid;
+    // index of the owning worker, UINT32_MAX for other threads
+    uint32_t worker;
+    uint32_t mask;
+    // events ever written, only the last `mask + 1` are kept
+    uint64_t head;
+    tp_trace_event_t *events;
+};
+
+
+/**
+ * Record an event into the calling thread's ring, creating it first.
+ *
+ * @param self worker running on the calling thread, NULL if it's not one
+ */
+void tp_trace_record(thread_pool_t *tp, tp_worker_t *self, tp_trace_kind_t kind, const void *task);
+
+/**
+ * Free the rings once no thread records into them.
+ */
+void tp_trace_destroy(thread_pool_t *tp);
+
+#ifdef TP_TRACE
+#define tp_trace(tp, self, kind, task) \
+do { \
+    if (__atomic_load_n(&(tp)->tracing, __ATOMIC_RELAXED)) { \
+        tp_trace_record((tp), (self), (kind), (task)); \
+    } \
+} while (0)
+#else
+#define tp_trace(tp, self, kind, task) ((void) 0)
+#endif
+
+
+#endif //TP_TRACE_H
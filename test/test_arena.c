@@ -0,0 +1,144 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "thread_pool.h"
+
+#define TASKS 100
+
+
+void test_alloc()
+{
+    arena_t arena;
+    char *p, *q, *first, *large;
+    size_t i;
+
+    fprintf(stderr, "test_alloc() started\n");
+
+    assert(!arena_init(&arena, 0));
+    assert(arena_init(&arena, 1000));
+    assert(arena.chunks == NULL);
+
+    // aligned and not overlapping
+    first = p = arena_alloc(&arena, 1);
+    q = arena_alloc(&arena, 3);
+    assert(p && q);
+    assert((uintptr_t) p % ARENA_ALIGN == 0);
+    assert((uintptr_t) q % ARENA_ALIGN == 0);
+    assert(q >= p + 1);
+
+    // more chunks once the first one is full
+    for (i = 0; i < 100; ++i) {
+        p = arena_alloc(&arena, 100);
+        assert(p && (uintptr_t) p % ARENA_ALIGN == 0);
+        memset(p, 0xab, 100);
+    }
+
+    assert(arena.chunks->next != NULL);
+
+    large = arena_alloc(&arena, 10000);
+    assert(large && arena.large != NULL);
+    memset(large, 0xcd, 10000);
+
+    // the chunks are reused from the first one
+    p = (char *) arena.chunks->next;
+    arena_reset(&arena);
+    assert(arena.used == 0 && arena.large == NULL);
+    assert(arena_alloc(&arena, 1) == first);
+
+    for (i = 0; i < 100; ++i) {
+        arena_alloc(&arena, 100);
+    }
+
+    assert(arena.chunks->next == (arena_chunk_t *) p);
+
+    arena_destroy(&arena);
+
+    fprintf(stderr, "test_alloc() succeed\n");
+}
+
+
+int g_ntask;
+
+
+void *scratch(void *args)
+{
+    void **ptrs = *(void ***) args;
+    tp_worker_t *self = tp_self_worker();
+    char *p;
+
+    p = tp_arena_alloc(64);
+    assert(p != NULL);
+    memset(p, 1, 64);
+
+    ptrs[g_ntask++] = p;
+
+    // nothing is left from the previous tasks unless it keeps them
+    assert(self->pool->attr.arena_keep || self->arena.used == 64);
+
+    return NULL;
+}
+
+
+void run_tasks(bool keep)
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+    void *ptrs[TASKS];
+    void **arg = ptrs;
+    int i;
+
+    g_ntask = 0;
+
+    tp_attr_init(&attr);
+    attr.arena_size = 4096;
+    attr.arena_keep = keep;
+
+    // one worker so that every task uses the same arena
+    assert(tp_init_attr(&tp, 1, &attr));
+    assert(tp_start(&tp));
+
+    for (i = 0; i < TASKS; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(scratch, NULL, &arg, sizeof(arg))));
+        tp_join_tasks(&tp);
+    }
+
+    for (i = 1; i < TASKS; ++i) {
+        if (keep) {
+            assert(ptrs[i] != ptrs[i - 1]);
+        } else {
+            assert(ptrs[i] == ptrs[0]);
+        }
+    }
+
+    if (keep) {
+        assert(tp.workers[0].arena.used == TASKS * 64);
+    }
+
+    tp_destroy(&tp);
+}
+
+
+void test_pool()
+{
+    fprintf(stderr, "test_pool() started\n");
+
+    // not a worker thread
+    assert(tp_arena_alloc(8) == NULL);
+    tp_arena_reset();
+
+    run_tasks(false);
+    run_tasks(true);
+
+    fprintf(stderr, "test_pool() succeed\n");
+}
+
+
+int main()
+{
+    test_alloc();
+    test_pool();
+
+    return 0;
+}
@@ -52,7 +52,7 @@ void test_atomic()
     assert(tp_join_tasks(&tp));
 
     assert(tp.active_tasks == 0);
-    assert(queue_isempty(&tp.task_queue));
+    assert(tp_queue_len(&tp) == 0);
 
     fprintf(stderr, "The atomic counter is %u\n", acnt);
     fprintf(stderr, "The non-atomic counter is %u\n", cnt);
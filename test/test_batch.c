@@ -0,0 +1,127 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 64
+#define THREAD_NUM 8
+#define CAPACITY 16
+
+
+volatile int g_running = 0;
+volatile int g_peak = 0;
+volatile int g_runs = 0;
+
+
+void *task1(void *args)
+{
+    int running;
+    int peak;
+
+    UNUSED_PARAM(args);
+
+    running = __sync_add_and_fetch(&g_running, 1);
+
+    do {
+        peak = g_peak;
+    } while (running > peak && !__sync_bool_compare_and_swap(&g_peak, peak, running));
+
+    usleep(20 * 1000);
+
+    __sync_sub_and_fetch(&g_running, 1);
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void run(tp_queue_kind_t kind)
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_task_t *tasks[TASK_NUM];
+
+    fprintf(stderr, "run(queue=%d) started\n", kind);
+
+    g_peak = 0;
+    g_runs = 0;
+
+    tp_attr_init(&attr);
+    attr.queue_kind = kind;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    // let all workers go idle
+    usleep(50 * 1000);
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        tasks[i] = tp_task_create(task1, NULL, NULL, 0);
+    }
+
+    assert(TASK_NUM == tp_post_tasks(&tp, tasks, TASK_NUM));
+    assert(tp_join_tasks(&tp));
+
+    // the batch woke up all workers, not just one
+    fprintf(stderr, "peak concurrency: %d\n", g_peak);
+    assert(TASK_NUM == g_runs);
+    assert(THREAD_NUM == g_peak);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "run(queue=%d) succeed\n", kind);
+}
+
+
+void test_partial()
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_task_t *tasks[TASK_NUM];
+
+    fprintf(stderr, "test_partial() started\n");
+
+    g_runs = 0;
+
+    tp_attr_init(&attr);
+    attr.queue_kind = TP_QUEUE_RING;
+    attr.queue_capacity = CAPACITY;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        tasks[i] = tp_task_create(task1, NULL, NULL, 0);
+    }
+
+    // not started, so only the first CAPACITY ones fit
+    assert(CAPACITY == tp_post_tasks(&tp, tasks, TASK_NUM));
+    assert(CAPACITY == tp.active_tasks);
+
+    for (i = CAPACITY; i < TASK_NUM; ++i) {
+        tp_task_free(tasks[i]);
+    }
+
+    assert(tp_start(&tp));
+    assert(tp_join_tasks(&tp));
+    assert(CAPACITY == g_runs);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_partial() succeed\n");
+}
+
+
+int main()
+{
+    run(TP_QUEUE_LIST);
+    run(TP_QUEUE_RING);
+    run(TP_QUEUE_INTRUSIVE);
+    test_partial();
+
+    return 0;
+}
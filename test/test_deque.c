@@ -0,0 +1,132 @@
+#include "deque.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LEN 100000
+#define NTHIEF 3
+#define CAPACITY 1024
+
+
+deque_t g_deque;
+volatile int g_done = 0;
+int g_taken[LEN];
+
+
+void test_single()
+{
+    int i;
+    qdata_t qdata;
+    deque_t deque;
+
+    fprintf(stderr, "test_single() started\n");
+
+    assert(deque_init(&deque, 100));
+    assert(deque_isempty(&deque));
+
+    // capacity is rounded up to 128
+    for (i = 0; i < 128; ++i) {
+        qdata.i32 = i;
+        assert(deque_push(&deque, qdata));
+    }
+
+    qdata.i32 = 128;
+    assert(!deque_push(&deque, qdata));
+    assert(128 == deque_len(&deque));
+
+    // thieves take the oldest one
+    assert(deque_steal(&deque, &qdata));
+    assert(0 == qdata.i32);
+
+    // owner takes the newest one
+    for (i = 127; i > 0; --i) {
+        assert(deque_pop(&deque, &qdata));
+        assert(i == qdata.i32);
+    }
+
+    assert(!deque_pop(&deque, &qdata));
+    assert(!deque_steal(&deque, &qdata));
+    assert(deque_isempty(&deque));
+
+    deque_destroy(&deque);
+
+    fprintf(stderr, "test_single() succeed\n");
+}
+
+
+void *thief(void *args)
+{
+    qdata_t qdata;
+
+    (void) args;
+
+    while (!__atomic_load_n(&g_done, __ATOMIC_ACQUIRE) || !deque_isempty(&g_deque)) {
+        if (deque_steal(&g_deque, &qdata)) {
+            __sync_add_and_fetch(&g_taken[qdata.i32], 1);
+        }
+    }
+
+    return NULL;
+}
+
+
+void test_concurrent()
+{
+    int i;
+    qdata_t qdata;
+    pthread_t thieves[NTHIEF];
+
+    fprintf(stderr, "test_concurrent() started\n");
+
+    assert(deque_init(&g_deque, CAPACITY));
+
+    for (i = 0; i < NTHIEF; ++i) {
+        assert(0 == pthread_create(&thieves[i], NULL, thief, NULL));
+    }
+
+    for (i = 0; i < LEN; ++i) {
+        qdata.i32 = i;
+
+        while (!deque_push(&g_deque, qdata)) {
+            if (deque_pop(&g_deque, &qdata)) {
+                __sync_add_and_fetch(&g_taken[qdata.i32], 1);
+            }
+            qdata.i32 = i;
+        }
+
+        if (i % 3 == 0 && deque_pop(&g_deque, &qdata)) {
+            __sync_add_and_fetch(&g_taken[qdata.i32], 1);
+        }
+    }
+
+    while (deque_pop(&g_deque, &qdata)) {
+        __sync_add_and_fetch(&g_taken[qdata.i32], 1);
+    }
+
+    __atomic_store_n(&g_done, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < NTHIEF; ++i) {
+        pthread_join(thieves[i], NULL);
+    }
+
+    // every element is taken exactly once
+    for (i = 0; i < LEN; ++i) {
+        assert(1 == g_taken[i]);
+    }
+
+    deque_destroy(&g_deque);
+
+    fprintf(stderr, "test_concurrent() succeed\n");
+}
+
+
+int main()
+{
+    test_single();
+    test_concurrent();
+
+    return 0;
+}
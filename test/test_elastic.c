@@ -0,0 +1,190 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 64
+#define MIN_THREADS 1
+#define MAX_THREADS 4
+
+
+volatile int g_runs = 0;
+
+
+void *slow_task(void *args)
+{
+    UNUSED_PARAM(args);
+
+    usleep(5 * 1000);
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void post_slow_tasks(thread_pool_t *tp, int n)
+{
+    int i;
+
+    g_runs = 0;
+
+    for (i = 0; i < n; ++i) {
+        assert(tp_post_task(tp, tp_task_create(slow_task, NULL, NULL, 0)));
+    }
+}
+
+
+void wait_live(thread_pool_t *tp, uint32_t n)
+{
+    int i;
+
+    for (i = 0; i < 5000 && tp_live_threads(tp) != n; ++i) {
+        usleep(1000);
+    }
+
+    assert(tp_live_threads(tp) == n);
+}
+
+
+void test_grow_shrink()
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_grow_shrink() started\n");
+
+    tp_attr_init(&attr);
+    attr.max_threads = MAX_THREADS;
+    attr.spawn_latency_us = 1000;
+    attr.keep_alive_ms = 50;
+
+    assert(tp_init_attr(&tp, MIN_THREADS, &attr));
+    assert(tp.nthread == MAX_THREADS);
+    assert(tp_start(&tp));
+    assert(tp_live_threads(&tp) == MIN_THREADS);
+
+    // tasks wait much longer than the spawn latency
+    post_slow_tasks(&tp, TASK_NUM);
+    assert(tp_join_tasks(&tp));
+    assert(TASK_NUM == g_runs);
+
+    fprintf(stderr, "spawned: %llu\n", (unsigned long long) tp.spawned);
+    assert(tp.spawned > 0);
+
+    // the extra workers leave after idling for the keep-alive
+    wait_live(&tp, MIN_THREADS);
+    assert(tp.retired == tp.spawned);
+
+    // and come back on demand
+    post_slow_tasks(&tp, TASK_NUM);
+    assert(tp_join_tasks(&tp));
+    assert(TASK_NUM == g_runs);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_grow_shrink() succeed\n");
+}
+
+
+void test_resize()
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_resize() started\n");
+
+    tp_attr_init(&attr);
+    attr.max_threads = MAX_THREADS;
+
+    assert(tp_init_attr(&tp, MIN_THREADS, &attr));
+    assert(tp_start(&tp));
+
+    assert(!tp_resize(&tp, 2, 1));
+    assert(!tp_resize(&tp, 0, 0));
+    assert(!tp_resize(&tp, 1, MAX_THREADS + 1));
+
+    // raising the minimum starts the workers at once
+    assert(tp_resize(&tp, MAX_THREADS, MAX_THREADS));
+    assert(tp_live_threads(&tp) == MAX_THREADS);
+
+    // lowering the maximum retires them, running tasks are finished first
+    post_slow_tasks(&tp, TASK_NUM);
+    assert(tp_resize(&tp, 1, 2));
+    wait_live(&tp, 2);
+    assert(tp_join_tasks(&tp));
+    assert(TASK_NUM == g_runs);
+
+    assert(tp_resize(&tp, 1, 1));
+    wait_live(&tp, 1);
+
+    post_slow_tasks(&tp, 8);
+    assert(tp_join_tasks(&tp));
+    assert(8 == g_runs);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_resize() succeed\n");
+}
+
+
+void test_zero_min()
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_zero_min() started\n");
+
+    tp_attr_init(&attr);
+    attr.max_threads = 2;
+    attr.keep_alive_ms = 20;
+
+    // no worker until the first task
+    assert(tp_init_attr(&tp, 0, &attr));
+    assert(tp_start(&tp));
+    assert(tp_live_threads(&tp) == 0);
+
+    post_slow_tasks(&tp, 8);
+    assert(tp_join_tasks(&tp));
+    assert(8 == g_runs);
+
+    wait_live(&tp, 0);
+
+    post_slow_tasks(&tp, 8);
+    assert(tp_join_tasks(&tp));
+    assert(8 == g_runs);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_zero_min() succeed\n");
+}
+
+
+void test_destroy_unstarted()
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_destroy_unstarted() started\n");
+
+    tp_attr_init(&attr);
+    attr.max_threads = MAX_THREADS;
+
+    assert(tp_init_attr(&tp, MIN_THREADS, &attr));
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_destroy_unstarted() succeed\n");
+}
+
+
+int main()
+{
+    test_grow_shrink();
+    test_resize();
+    test_zero_min();
+    test_destroy_unstarted();
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 100
+
+
+volatile int g_gate = 0;
+
+
+void *square(void *args)
+{
+    intptr_t n = *(intptr_t *) args;
+
+    return (void *) (n * n);
+}
+
+
+void *wait_gate(void *args)
+{
+    UNUSED_PARAM(args);
+
+    while (!__atomic_load_n(&g_gate, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+
+    return (void *) 7;
+}
+
+
+void test_wait()
+{
+    intptr_t i;
+    thread_pool_t tp;
+    tp_future_t *futures[TASK_NUM];
+
+    fprintf(stderr, "test_wait() started\n");
+
+    assert(tp_init(&tp, 4));
+    assert(tp_start(&tp));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        futures[i] = tp_post_task_future(&tp, tp_task_create(square, NULL, &i, sizeof(i)));
+        assert(futures[i]);
+    }
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert((void *) (i * i) == tp_future_wait(futures[i]));
+        assert(!tp_future_cancelled(futures[i]));
+        tp_future_release(futures[i]);
+    }
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_wait() succeed\n");
+}
+
+
+void test_timeout()
+{
+    void *result = NULL;
+    thread_pool_t tp;
+    tp_future_t *future;
+
+    fprintf(stderr, "test_timeout() started\n");
+
+    assert(tp_init(&tp, 1));
+    assert(tp_start(&tp));
+
+    future = tp_post_task_future(&tp, tp_task_create(wait_gate, NULL, NULL, 0));
+    assert(future);
+
+    assert(!tp_future_try_get(future, &result));
+    assert(!tp_future_wait_for(future, 10000, &result));
+    assert(result == NULL);
+
+    __atomic_store_n(&g_gate, 1, __ATOMIC_RELEASE);
+
+    assert(tp_future_wait_for(future, 10 * 1000 * 1000, &result));
+    assert(result == (void *) 7);
+    assert(tp_future_try_get(future, &result));
+
+    tp_future_release(future);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_timeout() succeed\n");
+}
+
+
+void test_cancel()
+{
+    void *result = (void *) 1;
+    qdata_t data;
+    tp_task_t *task;
+    tp_future_t *future;
+    thread_pool_t tp;
+
+    fprintf(stderr, "test_cancel() started\n");
+
+    // never started, so the task stays in the queue
+    assert(tp_init(&tp, 1));
+
+    task = tp_task_create(square, NULL, &result, sizeof(result));
+    future = tp_post_task_future(&tp, task);
+    assert(future);
+
+    // destroying the task without running it cancels the future
+    assert(queue_dequeue(&tp.lanes[TP_PRIORITY_NORMAL].queue, &data));
+    assert(data.ptr == task);
+    tp_task_free(task);
+
+    assert(tp_future_wait_for(future, 0, &result));
+    assert(result == NULL);
+    assert(tp_future_cancelled(future));
+
+    tp_future_release(future);
+
+    assert(tp_start(&tp));
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_cancel() succeed\n");
+}
+
+
+int main()
+{
+    test_wait();
+    test_timeout();
+    test_cancel();
+
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+
+
+#define THREAD_NUM 4
+#define FAN 1000
+
+
+volatile int g_seq = 0;
+volatile int g_runs = 0;
+volatile int g_cleanups = 0;
+volatile int g_ticks = 0;
+
+
+typedef struct
+{
+    int id;
+    // order in which it ran, and the thread it ran on
+    int *order;
+    pthread_t *thread;
+} node_arg_t;
+
+
+void *node(void *args)
+{
+    node_arg_t *arg = args;
+
+    if (arg->order) {
+        arg->order[arg->id] = __sync_add_and_fetch(&g_seq, 1);
+    }
+
+    if (arg->thread) {
+        arg->thread[arg->id] = pthread_self();
+    }
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void cleanup1(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_cleanups, 1);
+}
+
+
+void *tick(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_ticks, 1);
+
+    return NULL;
+}
+
+
+tp_task_t *create_node(int id, int *order, pthread_t *thread)
+{
+    node_arg_t arg;
+
+    arg.id = id;
+    arg.order = order;
+    arg.thread = thread;
+
+    return tp_task_create(node, cleanup1, &arg, sizeof(arg));
+}
+
+
+void reset()
+{
+    g_seq = 0;
+    g_runs = 0;
+    g_cleanups = 0;
+    g_ticks = 0;
+}
+
+
+void test_chain(thread_pool_t *tp)
+{
+    int i;
+    int order[3];
+    pthread_t thread[3];
+    tp_task_t *tasks[3];
+
+    fprintf(stderr, "test_chain() started\n");
+    reset();
+
+    for (i = 0; i < 3; ++i) {
+        tasks[i] = create_node(i, order, thread);
+    }
+
+    assert(tp_task_then(tasks[0], tasks[1]));
+    assert(tp_task_then(tasks[1], tasks[2]));
+    assert(!tp_task_then(tasks[0], tasks[0]));
+
+    // successors first, they're held until their predecessor finished
+    assert(tp_post_task(tp, tasks[2]));
+    assert(tp_post_task(tp, tasks[1]));
+    usleep(10000);
+    assert(0 == g_runs);
+    assert(2 == tp->active_tasks);
+
+    assert(tp_post_task(tp, tasks[0]));
+    tp_join_tasks(tp);
+
+    assert(3 == g_runs);
+    assert(order[0] < order[1] && order[1] < order[2]);
+
+    // a ready successor runs on the thread of its predecessor
+    assert(pthread_equal(thread[0], thread[1]));
+    assert(pthread_equal(thread[1], thread[2]));
+
+    fprintf(stderr, "test_chain() succeed\n");
+}
+
+
+void test_diamond(thread_pool_t *tp)
+{
+    int order[4];
+    tp_task_t *a, *b, *c, *d;
+
+    fprintf(stderr, "test_diamond() started\n");
+    reset();
+
+    a = create_node(0, order, NULL);
+    b = create_node(1, order, NULL);
+    c = create_node(2, order, NULL);
+    d = create_node(3, order, NULL);
+
+    assert(tp_task_then(a, b));
+    assert(tp_task_then(a, c));
+    assert(tp_task_then(b, d));
+    assert(tp_task_then(c, d));
+
+    assert(tp_post_task(tp, a));
+    assert(tp_post_task(tp, b));
+    assert(tp_post_task(tp, c));
+    assert(tp_post_task(tp, d));
+    tp_join_tasks(tp);
+
+    assert(4 == g_runs);
+    assert(order[0] < order[1] && order[0] < order[2]);
+    assert(order[1] < order[3] && order[2] < order[3]);
+
+    fprintf(stderr, "test_diamond() succeed\n");
+}
+
+
+void test_fan(thread_pool_t *tp)
+{
+    int i;
+    int order[FAN + 2];
+    tp_task_t *root;
+    tp_task_t *sink;
+    tp_task_t *tasks[FAN];
+
+    fprintf(stderr, "test_fan() started\n");
+    reset();
+
+    root = create_node(0, order, NULL);
+    sink = create_node(FAN + 1, order, NULL);
+
+    for (i = 0; i < FAN; ++i) {
+        tasks[i] = create_node(i + 1, order, NULL);
+        assert(tp_task_then(root, tasks[i]));
+        assert(tp_task_then(tasks[i], sink));
+    }
+
+    assert(tp_post_task(tp, sink));
+    // held ones are posted one by one
+    assert(FAN == tp_post_tasks(tp, tasks, FAN));
+    assert(tp_post_task(tp, root));
+    tp_join_tasks(tp);
+
+    assert(FAN + 2 == g_runs);
+
+    for (i = 1; i <= FAN; ++i) {
+        assert(order[0] < order[i] && order[i] < order[FAN + 1]);
+    }
+
+    fprintf(stderr, "test_fan() succeed\n");
+}
+
+
+void test_cancel(thread_pool_t *tp)
+{
+    tp_task_t *a, *b, *c;
+
+    fprintf(stderr, "test_cancel() started\n");
+    reset();
+
+    // a predecessor destroyed before its successor is posted
+    a = create_node(0, NULL, NULL);
+    b = create_node(1, NULL, NULL);
+    assert(tp_task_then(a, b));
+    tp_task_free(a);
+
+    assert(tp_post_task(tp, b));
+    tp_join_tasks(tp);
+    assert(0 == g_runs);
+    assert(1 == g_cleanups);
+
+    // and after, the whole chain is discarded
+    a = create_node(0, NULL, NULL);
+    b = create_node(1, NULL, NULL);
+    c = create_node(2, NULL, NULL);
+    assert(tp_task_then(a, b));
+    assert(tp_task_then(b, c));
+    assert(tp_post_task(tp, b));
+    assert(tp_post_task(tp, c));
+    tp_task_free(a);
+
+    tp_join_tasks(tp);
+    assert(0 == g_runs);
+    assert(3 == g_cleanups);
+
+    fprintf(stderr, "test_cancel() succeed\n");
+}
+
+
+void test_periodic(thread_pool_t *tp)
+{
+    tp_task_t *a, *b;
+
+    fprintf(stderr, "test_periodic() started\n");
+    reset();
+
+    a = tp_task_create(tick, NULL, NULL, 0);
+    b = create_node(1, NULL, NULL);
+    assert(tp_task_then(a, b));
+    assert(tp_post_task(tp, b));
+    assert(tp_post_periodic(tp, a, 0, 1000));
+
+    // held while the periodic task keeps running
+    while (g_ticks < 3) {
+        usleep(1000);
+    }
+    assert(0 == g_runs);
+
+    // and released once it's cancelled, between runs or in one
+    tp_cancel_periodic(a);
+    tp_join_tasks(tp);
+    assert(1 == g_runs);
+    assert(1 == g_cleanups);
+
+    fprintf(stderr, "test_periodic() succeed\n");
+}
+
+
+void test_pools()
+{
+    int order[2];
+    thread_pool_t tp1;
+    thread_pool_t tp2;
+    tp_task_t *a, *b;
+
+    fprintf(stderr, "test_pools() started\n");
+    reset();
+
+    assert(tp_init(&tp1, 1));
+    assert(tp_init(&tp2, 1));
+    assert(tp_start(&tp1));
+    assert(tp_start(&tp2));
+
+    a = create_node(0, order, NULL);
+    b = create_node(1, order, NULL);
+    assert(tp_task_then(a, b));
+
+    // queued to its own pool when it's ready
+    assert(tp_post_task(&tp2, b));
+    assert(tp_post_task(&tp1, a));
+    tp_join_tasks(&tp1);
+    tp_join_tasks(&tp2);
+
+    assert(2 == g_runs);
+    assert(order[0] < order[1]);
+
+    tp_destroy(&tp1);
+    tp_destroy(&tp2);
+
+    fprintf(stderr, "test_pools() succeed\n");
+}
+
+
+void test_shutdown()
+{
+    thread_pool_t tp;
+    tp_task_t *a, *b;
+
+    fprintf(stderr, "test_shutdown() started\n");
+    reset();
+
+    // not started, the predecessor stays queued
+    assert(tp_init(&tp, 1));
+
+    a = create_node(0, NULL, NULL);
+    b = create_node(1, NULL, NULL);
+    assert(tp_task_then(a, b));
+    assert(tp_post_task(&tp, a));
+    assert(tp_post_task(&tp, b));
+
+    // the held successor is discarded with it
+    tp_destroy(&tp);
+    assert(0 == g_runs);
+    assert(2 == g_cleanups);
+
+    fprintf(stderr, "test_shutdown() succeed\n");
+}
+
+
+int main()
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+    test_chain(&tp);
+    test_diamond(&tp);
+    test_fan(&tp);
+    test_cancel(&tp);
+    test_periodic(&tp);
+    tp_destroy(&tp);
+
+    tp_attr_init(&attr);
+    attr.sched = TP_SCHED_STEALING;
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+    test_chain(&tp);
+    test_diamond(&tp);
+    test_fan(&tp);
+    tp_destroy(&tp);
+
+    test_pools();
+    test_shutdown();
+
+    return 0;
+}
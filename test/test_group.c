@@ -0,0 +1,202 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 100
+
+
+volatile int g_gate = 0;
+volatile int g_fast = 0;
+
+
+void *slow(void *args)
+{
+    UNUSED_PARAM(args);
+
+    while (!__atomic_load_n(&g_gate, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+
+    return NULL;
+}
+
+
+void *fast(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_fast, 1);
+
+    return NULL;
+}
+
+
+void test_join_idle()
+{
+    thread_pool_t tp;
+
+    fprintf(stderr, "test_join_idle() started\n");
+
+    assert(tp_init(&tp, 2));
+    assert(tp_start(&tp));
+
+    // nothing posted, must not block
+    assert(tp_join_tasks(&tp));
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_join_idle() succeed\n");
+}
+
+
+void test_isolation()
+{
+    int i;
+    thread_pool_t tp;
+    tp_group_t slow_group;
+    tp_group_t fast_group;
+
+    fprintf(stderr, "test_isolation() started\n");
+
+    g_gate = 0;
+    g_fast = 0;
+
+    tp_group_init(&slow_group);
+    tp_group_init(&fast_group);
+
+    assert(tp_init(&tp, 4));
+    assert(tp_start(&tp));
+
+    assert(tp_group_post(&tp, &slow_group, tp_task_create(slow, NULL, NULL, 0)));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_group_post(&tp, &fast_group, tp_task_create(fast, NULL, NULL, 0)));
+    }
+
+    // doesn't wait for the slow task of the other group
+    tp_group_wait(&tp, &fast_group, false);
+    assert(TASK_NUM == g_fast);
+    assert(0 == tp_group_pending(&fast_group));
+    assert(1 == tp_group_pending(&slow_group));
+
+    __atomic_store_n(&g_gate, 1, __ATOMIC_RELEASE);
+    tp_group_wait(&tp, &slow_group, false);
+    assert(0 == tp_group_pending(&slow_group));
+
+    assert(tp_join_tasks(&tp));
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_isolation() succeed\n");
+}
+
+
+void test_help()
+{
+    int i;
+    thread_pool_t tp;
+    tp_group_t group;
+
+    fprintf(stderr, "test_help() started\n");
+
+    g_gate = 0;
+    g_fast = 0;
+
+    tp_group_init(&group);
+
+    // the only worker is blocked, so the waiter has to run the tasks
+    assert(tp_init(&tp, 1));
+    assert(tp_start(&tp));
+
+    assert(tp_post_task(&tp, tp_task_create(slow, NULL, NULL, 0)));
+
+    // make sure the worker took the slow one
+    while (tp_queue_len(&tp) > 0) {
+        usleep(1000);
+    }
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_group_post(&tp, &group, tp_task_create(fast, NULL, NULL, 0)));
+    }
+
+    tp_group_wait(&tp, &group, true);
+    assert(TASK_NUM == g_fast);
+
+    __atomic_store_n(&g_gate, 1, __ATOMIC_RELEASE);
+
+    assert(tp_join_tasks(&tp));
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_help() succeed\n");
+}
+
+
+void test_latch()
+{
+    tp_group_t group;
+
+    fprintf(stderr, "test_latch() started\n");
+
+    tp_group_init(&group);
+    tp_group_add(&group, 2);
+    tp_group_done(&group);
+    assert(1 == tp_group_pending(&group));
+    tp_group_done(&group);
+    tp_group_wait(NULL, &group, false);
+
+    fprintf(stderr, "test_latch() succeed\n");
+}
+
+
+void *sleepy(void *args)
+{
+    UNUSED_PARAM(args);
+
+    usleep(100);
+
+    return NULL;
+}
+
+
+void test_free()
+{
+    int i;
+    thread_pool_t tp;
+    tp_group_t *group;
+
+    fprintf(stderr, "test_free() started\n");
+
+    assert(tp_init(&tp, 4));
+    assert(tp_start(&tp));
+
+    // the waiter frees the group as soon as it returns, while the
+    // last task may still be finishing tp_group_done()
+    for (i = 0; i < 1000; ++i) {
+        group = malloc(sizeof(tp_group_t));
+        tp_group_init(group);
+        assert(tp_group_post(&tp, group, tp_task_create(i % 2 ? sleepy : fast, NULL, NULL, 0)));
+        tp_group_wait(&tp, group, false);
+        assert(0 == tp_group_pending(group));
+        free(group);
+    }
+
+    tp_join_tasks(&tp);
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_free() succeed\n");
+}
+
+
+int main()
+{
+    test_join_idle();
+    test_isolation();
+    test_help();
+    test_latch();
+    test_free();
+
+    return 0;
+}
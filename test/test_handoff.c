@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "thread_pool.h"
+
+#define TASK_NUM 1000
+
+
+thread_pool_t g_io;
+thread_pool_t g_cpu;
+int g_cleanups;
+
+
+void count_cleanup(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_cleanups, 1);
+}
+
+
+void *store(void *args)
+{
+    assert(tp_self() == &g_io);
+
+    return (void *) (intptr_t) (*(int *) args * 2);
+}
+
+
+void *decode(void *args)
+{
+    assert(tp_self() == &g_cpu);
+
+    *(int *) args += 1;
+    assert(tp_task_handoff(&g_io, store));
+
+    return NULL;
+}
+
+
+void *read_stage(void *args)
+{
+    assert(tp_self() == &g_io);
+
+    *(int *) args *= 10;
+    assert(tp_task_handoff(&g_cpu, decode));
+
+    return NULL;
+}
+
+
+void test_pipeline()
+{
+    int i;
+    tp_task_t *task;
+    tp_future_t *futures[TASK_NUM];
+
+    fprintf(stderr, "test_pipeline() started\n");
+
+    assert(!tp_task_handoff(&g_cpu, decode));
+
+    assert(tp_init(&g_io, 2));
+    assert(tp_init(&g_cpu, 3));
+    assert(tp_start(&g_io));
+    assert(tp_start(&g_cpu));
+
+    g_cleanups = 0;
+
+    // io -> cpu -> io in the same task, the future gets the last result
+    for (i = 0; i < TASK_NUM; ++i) {
+        task = tp_task_create_pooled(&g_io, read_stage, count_cleanup, &i, sizeof(i));
+        assert(task);
+        futures[i] = tp_post_task_future(&g_io, task);
+        assert(futures[i]);
+    }
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert((void *) (intptr_t) ((i * 10 + 1) * 2) == tp_future_wait(futures[i]));
+        tp_future_release(futures[i]);
+    }
+
+    tp_join_tasks(&g_io);
+    tp_join_tasks(&g_cpu);
+
+    // cleaned up once, after the last stage
+    assert(g_cleanups == TASK_NUM);
+
+    fprintf(stderr, "test_pipeline() succeed\n");
+}
+
+
+void *check_io(void *args)
+{
+    UNUSED_PARAM(args);
+
+    assert(tp_self() == &g_io);
+
+    return NULL;
+}
+
+
+void test_isolation()
+{
+    int i;
+
+    fprintf(stderr, "test_isolation() started\n");
+
+    // the cpu pool comes and goes while the io pool runs
+    for (i = 0; i < 10; ++i) {
+        assert(tp_post_task(&g_io, tp_task_create(check_io, NULL, NULL, 0)));
+
+        tp_destroy(&g_cpu);
+        assert(tp_init(&g_cpu, 2));
+        assert(tp_start(&g_cpu));
+    }
+
+    tp_join_tasks(&g_io);
+    tp_destroy(&g_cpu);
+    tp_destroy(&g_io);
+
+    fprintf(stderr, "test_isolation() succeed\n");
+}
+
+
+int main()
+{
+    test_pipeline();
+    test_isolation();
+
+    return 0;
+}
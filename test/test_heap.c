@@ -0,0 +1,89 @@
+#include "heap.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LEN 10000
+
+
+void test_order()
+{
+    int i;
+    qdata_t qdata;
+    heap_t heap;
+    heap_node_t node;
+    uint64_t key;
+    uint64_t last = 0;
+
+    fprintf(stderr, "test_order() started\n");
+
+    assert(heap_init(&heap, 0));
+    assert(heap_isempty(&heap));
+    assert(!heap_top(&heap, &node));
+    assert(!heap_pop(&heap, &node));
+
+    srand(1);
+
+    for (i = 0; i < LEN; ++i) {
+        qdata.i32 = i;
+        assert(heap_push(&heap, (uint64_t) (rand() % 1000), qdata));
+    }
+
+    assert(LEN == heap_len(&heap));
+
+    for (i = 0; i < LEN; ++i) {
+        assert(heap_top(&heap, &node));
+        key = node.key;
+        assert(heap_pop(&heap, &node));
+        assert(key == node.key && key >= last);
+        last = key;
+    }
+
+    assert(heap_isempty(&heap));
+
+    heap_destroy(&heap);
+
+    fprintf(stderr, "test_order() succeed\n");
+}
+
+
+void test_interleaved()
+{
+    int i;
+    qdata_t qdata;
+    heap_t heap;
+    heap_node_t node;
+
+    fprintf(stderr, "test_interleaved() started\n");
+
+    assert(heap_init(&heap, 4));
+
+    // keys pushed while popping still come out sorted
+    for (i = 0; i < LEN; ++i) {
+        qdata.i32 = i;
+        assert(heap_push(&heap, (uint64_t) (LEN - i), qdata));
+
+        if (i % 3 == 2) {
+            assert(heap_pop(&heap, &node));
+            assert((uint64_t) (LEN - i) == node.key);
+            assert(i == node.data.i32);
+        }
+    }
+
+    assert(LEN - LEN / 3 == heap_len(&heap));
+
+    heap_destroy(&heap);
+
+    fprintf(stderr, "test_interleaved() succeed\n");
+}
+
+
+int main()
+{
+    test_order();
+    test_interleaved();
+
+    return 0;
+}
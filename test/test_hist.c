@@ -0,0 +1,121 @@
+#include "hist.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LEN 100000
+
+
+void test_buckets()
+{
+    uint32_t i;
+    uint64_t value;
+
+    fprintf(stderr, "test_buckets() started\n");
+
+    // small values are exact
+    for (value = 0; value < 2 * HIST_SUB; ++value) {
+        assert(value == hist_bucket(value));
+        assert(value == hist_bucket_upper((uint32_t) value));
+    }
+
+    // buckets are contiguous and each value is within its own
+    for (i = 1; i < HIST_BUCKETS - 1; ++i) {
+        assert(hist_bucket(hist_bucket_upper(i)) == i);
+        assert(hist_bucket(hist_bucket_upper(i) + 1) == i + 1);
+    }
+
+    assert(HIST_BUCKETS - 1 == hist_bucket(UINT64_MAX));
+    assert(UINT64_MAX == hist_bucket_upper(HIST_BUCKETS - 1));
+
+    // never wider than 1/HIST_SUB of the values
+    for (value = 2 * HIST_SUB; value < 1000000; value = value * 3 / 2) {
+        i = hist_bucket(value);
+        assert(hist_bucket_upper(i) - hist_bucket_upper(i - 1) <= value / HIST_SUB);
+    }
+
+    fprintf(stderr, "test_buckets() succeed\n");
+}
+
+
+void test_percentile()
+{
+    uint64_t i;
+    uint64_t p50;
+    uint64_t p99;
+    hist_t hist;
+
+    fprintf(stderr, "test_percentile() started\n");
+
+    hist_init(&hist);
+    assert(0 == hist.total);
+    assert(0 == hist_percentile(&hist, 50));
+    assert(0.0 == hist_mean(&hist));
+
+    for (i = 1; i <= LEN; ++i) {
+        hist_record(&hist, i);
+    }
+
+    assert(LEN == hist.total);
+    assert(1 == hist.min);
+    assert(LEN == hist.max);
+    assert((LEN + 1) / 2.0 == hist_mean(&hist));
+
+    // within the relative error of a bucket
+    p50 = hist_percentile(&hist, 50);
+    p99 = hist_percentile(&hist, 99);
+    assert(p50 >= LEN / 2 && p50 <= LEN / 2 + LEN / 2 / HIST_SUB);
+    assert(p99 >= LEN / 100 * 99 && p99 <= LEN);
+    assert(LEN == hist_percentile(&hist, 100));
+    assert(1 == hist_percentile(&hist, 0));
+
+    fprintf(stderr, "test_percentile() succeed\n");
+}
+
+
+void test_merge()
+{
+    int i;
+    hist_t a;
+    hist_t b;
+
+    fprintf(stderr, "test_merge() started\n");
+
+    hist_init(&a);
+    hist_init(&b);
+
+    for (i = 0; i < 100; ++i) {
+        hist_record(&a, 10);
+        hist_record(&b, 1000);
+    }
+
+    // an empty one changes nothing
+    hist_init(&b);
+    hist_merge(&a, &b);
+    assert(100 == a.total);
+    assert(10 == a.min && 10 == a.max);
+
+    for (i = 0; i < 100; ++i) {
+        hist_record(&b, 1000);
+    }
+
+    hist_merge(&a, &b);
+    assert(200 == a.total);
+    assert(100 * 10 + 100 * 1000 == a.sum);
+    assert(10 == a.min && 1000 == a.max);
+    assert(10 == hist_percentile(&a, 50));
+    assert(1000 == hist_percentile(&a, 51));
+
+    fprintf(stderr, "test_merge() succeed\n");
+}
+
+
+int main()
+{
+    test_buckets();
+    test_percentile();
+    test_merge();
+
+    return 0;
+}
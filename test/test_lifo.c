@@ -0,0 +1,225 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+
+
+#define CHAIN 20
+// TP_LIFO_MAX_STREAK of the pool
+#define MAX_STREAK 3
+
+
+volatile int g_seq = 0;
+volatile int g_gate = 0;
+volatile int g_child_done = 0;
+int g_order[CHAIN + 2];
+pthread_t g_threads[2];
+
+
+void *record(void *args)
+{
+    int id = *(int *) args;
+
+    g_order[id] = __sync_add_and_fetch(&g_seq, 1);
+
+    return NULL;
+}
+
+
+// Posts the next link of the chain from the worker
+void *link1(void *args)
+{
+    int id = *(int *) args;
+    int next = id + 1;
+
+    record(args);
+
+    if (next < CHAIN) {
+        assert(tp_post_task(tp_self(), tp_task_create(link1, NULL, &next, sizeof(next))));
+    }
+
+    return NULL;
+}
+
+
+void reset()
+{
+    int i;
+
+    g_seq = 0;
+    g_gate = 0;
+    g_child_done = 0;
+
+    for (i = 0; i < CHAIN + 2; ++i) {
+        g_order[i] = 0;
+    }
+}
+
+
+void init_pool(thread_pool_t *tp, uint32_t nthreads, tp_sched_t sched, bool lifo_slot)
+{
+    tp_attr_t attr;
+
+    tp_attr_init(&attr);
+    attr.sched = sched;
+    attr.lifo_slot = lifo_slot;
+
+    assert(tp_init_attr(tp, nthreads, &attr));
+}
+
+
+void test_order(tp_sched_t sched)
+{
+    int id = 0;
+    int other = CHAIN;
+    thread_pool_t tp;
+
+    fprintf(stderr, "test_order(%d) started\n", sched);
+
+    // one worker, started after posting, so the chain is racing `other`
+    reset();
+    init_pool(&tp, 1, sched, true);
+    assert(tp_post_task(&tp, tp_task_create(link1, NULL, &id, sizeof(id))));
+    assert(tp_post_task(&tp, tp_task_create(record, NULL, &other, sizeof(other))));
+    assert(tp_start(&tp));
+    tp_join_tasks(&tp);
+
+    // the first links run next, then the queue gets its turn
+    assert(g_order[1] == 2);
+    assert(g_order[MAX_STREAK] < g_order[CHAIN]);
+    assert(g_order[CHAIN] < g_order[MAX_STREAK + 1]);
+    tp_destroy(&tp);
+
+    // without the slot the links go behind `other`
+    reset();
+    init_pool(&tp, 1, TP_SCHED_SHARED, false);
+    assert(tp_post_task(&tp, tp_task_create(link1, NULL, &id, sizeof(id))));
+    assert(tp_post_task(&tp, tp_task_create(record, NULL, &other, sizeof(other))));
+    assert(tp_start(&tp));
+    tp_join_tasks(&tp);
+
+    assert(g_order[CHAIN] == 2);
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_order(%d) succeed\n", sched);
+}
+
+
+void test_streak(tp_sched_t sched)
+{
+    int id = 0;
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_streak(%d) started\n", sched);
+
+    // nothing else queued when the streak runs out, the worker goes
+    // back to its slot instead of idling with a task in it
+    reset();
+    tp_attr_init(&attr);
+    attr.sched = sched;
+    attr.spin_us = 1000;
+    attr.lifo_slot = true;
+    assert(tp_init_attr(&tp, 1, &attr));
+    assert(tp_post_task(&tp, tp_task_create(link1, NULL, &id, sizeof(id))));
+    assert(tp_start(&tp));
+    tp_join_tasks(&tp);
+
+    // only a task found after idling updates it
+    assert(g_seq == CHAIN);
+    assert(tp.workers[0].idle_ewma_ns == 0);
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_streak(%d) succeed\n", sched);
+}
+
+
+void *blocker(void *args)
+{
+    UNUSED_PARAM(args);
+
+    while (!__atomic_load_n(&g_gate, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+
+    return NULL;
+}
+
+
+void *child(void *args)
+{
+    UNUSED_PARAM(args);
+
+    g_threads[1] = pthread_self();
+    __atomic_store_n(&g_child_done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+
+void *parent(void *args)
+{
+    bool wait = *(bool *) args;
+
+    g_threads[0] = pthread_self();
+    assert(tp_post_task(tp_self(), tp_task_create(child, NULL, NULL, 0)));
+
+    // Only another worker can run the child meanwhile
+    while (wait && !__atomic_load_n(&g_child_done, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+
+    return NULL;
+}
+
+
+void test_locality(tp_sched_t sched)
+{
+    bool wait = false;
+    thread_pool_t tp;
+
+    fprintf(stderr, "test_locality(%d) started\n", sched);
+
+    // the other worker is busy, the child runs on its parent's worker
+    reset();
+    init_pool(&tp, 2, sched, true);
+    assert(tp_start(&tp));
+    assert(tp_post_task(&tp, tp_task_create(blocker, NULL, NULL, 0)));
+    usleep(10000);
+    assert(tp_post_task(&tp, tp_task_create(parent, NULL, &wait, sizeof(wait))));
+
+    while (!__atomic_load_n(&g_child_done, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+
+    assert(pthread_equal(g_threads[0], g_threads[1]));
+    __atomic_store_n(&g_gate, 1, __ATOMIC_RELEASE);
+    tp_join_tasks(&tp);
+
+    // the parent keeps its worker, the idle one steals the child
+    reset();
+    wait = true;
+    assert(tp_post_task(&tp, tp_task_create(parent, NULL, &wait, sizeof(wait))));
+    tp_join_tasks(&tp);
+
+    assert(!pthread_equal(g_threads[0], g_threads[1]));
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_locality(%d) succeed\n", sched);
+}
+
+
+int main()
+{
+    test_order(TP_SCHED_SHARED);
+    test_order(TP_SCHED_STEALING);
+    test_streak(TP_SCHED_SHARED);
+    test_streak(TP_SCHED_STEALING);
+    test_locality(TP_SCHED_SHARED);
+    test_locality(TP_SCHED_STEALING);
+
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define THREAD_NUM 4
+#define TASK_NUM 1000
+#define SLEEP_US 1000
+
+
+void *task1(void *args)
+{
+    UNUSED_PARAM(args);
+
+    return NULL;
+}
+
+
+void *sleeper(void *args)
+{
+    UNUSED_PARAM(args);
+
+    usleep(SLEEP_US);
+
+    return NULL;
+}
+
+
+// Posts from a worker, counted in its own shard
+void *poster(void *args)
+{
+    int i;
+    thread_pool_t *tp = tp_self();
+
+    UNUSED_PARAM(args);
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(tp, tp_task_create(task1, NULL, NULL, 0)));
+    }
+
+    return NULL;
+}
+
+
+void test_counters(tp_sched_t sched)
+{
+    int i;
+    uint32_t w;
+    uint64_t posted = 0;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_metrics_t metrics;
+    tp_worker_metrics_t worker;
+
+    fprintf(stderr, "test_counters(%d) started\n", sched);
+
+    tp_attr_init(&attr);
+    attr.sched = sched;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(task1, NULL, NULL, 0)));
+    }
+
+    assert(tp_post_task(&tp, tp_task_create(poster, NULL, NULL, 0)));
+    tp_join_tasks(&tp);
+
+    tp_metrics_snapshot(&tp, &metrics);
+    assert(2 * TASK_NUM + 1 == metrics.posted);
+    assert(2 * TASK_NUM + 1 == metrics.completed);
+    assert(0 == metrics.rejected);
+    assert(0 == metrics.active_tasks);
+    assert(0 == metrics.queue_depth);
+    assert(THREAD_NUM == metrics.live_threads);
+
+    // histograms are off by default
+    assert(0 == metrics.wait_ns.total);
+    assert(0 == metrics.run_ns.total);
+
+    for (w = 0; w < THREAD_NUM; ++w) {
+        assert(tp_worker_metrics(&tp, w, &worker));
+        posted += worker.posted;
+    }
+
+    assert(TASK_NUM == posted);
+    assert(!tp_worker_metrics(&tp, THREAD_NUM, &worker));
+
+    fprintf(stderr, "stolen: %llu\n", (unsigned long long) metrics.stolen);
+
+    if (sched == TP_SCHED_SHARED) {
+        assert(0 == metrics.stolen);
+    }
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_counters(%d) succeed\n", sched);
+}
+
+
+void test_histograms()
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_task_t *tasks[TASK_NUM];
+    tp_metrics_t metrics;
+
+    fprintf(stderr, "test_histograms() started\n");
+
+    tp_attr_init(&attr);
+    attr.metrics = true;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    for (i = 0; i < 100; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(sleeper, NULL, NULL, 0)));
+    }
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        tasks[i] = tp_task_create(task1, NULL, NULL, 0);
+    }
+
+    assert(TASK_NUM == tp_post_tasks(&tp, tasks, TASK_NUM));
+    tp_join_tasks(&tp);
+
+    tp_metrics_snapshot(&tp, &metrics);
+    assert(TASK_NUM + 100 == metrics.posted);
+    assert(TASK_NUM + 100 == metrics.wait_ns.total);
+    assert(TASK_NUM + 100 == metrics.run_ns.total);
+    assert(metrics.queue_high_water > 0);
+
+    // one in eleven tasks sleeps
+    assert(metrics.run_ns.max >= SLEEP_US * 1000);
+    assert(hist_percentile(&metrics.run_ns, 95) >= SLEEP_US * 1000);
+    assert(hist_percentile(&metrics.run_ns, 50) < SLEEP_US * 1000);
+
+    fprintf(stderr, "wait p50: %llu ns, p99: %llu ns, run p50: %llu ns, p99: %llu ns\n",
+            (unsigned long long) hist_percentile(&metrics.wait_ns, 50),
+            (unsigned long long) hist_percentile(&metrics.wait_ns, 99),
+            (unsigned long long) hist_percentile(&metrics.run_ns, 50),
+            (unsigned long long) hist_percentile(&metrics.run_ns, 99));
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_histograms() succeed\n");
+}
+
+
+void test_rejected()
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_task_t *tasks[4];
+    tp_metrics_t metrics;
+    int i;
+
+    fprintf(stderr, "test_rejected() started\n");
+
+    tp_attr_init(&attr);
+    attr.max_queued = 1;
+    attr.overflow = TP_OVERFLOW_FAIL;
+
+    // not started, tasks stay queued
+    assert(tp_init_attr(&tp, 1, &attr));
+
+    assert(tp_post_task(&tp, tp_task_create(task1, NULL, NULL, 0)));
+
+    for (i = 0; i < 4; ++i) {
+        tasks[i] = tp_task_create(task1, NULL, NULL, 0);
+    }
+
+    assert(!tp_post_task(&tp, tasks[0]));
+    assert(0 == tp_post_tasks(&tp, tasks + 1, 3));
+
+    tp_metrics_snapshot(&tp, &metrics);
+    assert(1 == metrics.posted);
+    assert(4 == metrics.rejected);
+    assert(1 == metrics.queue_depth);
+    assert(1 == metrics.active_tasks);
+
+    for (i = 0; i < 4; ++i) {
+        tp_task_free(tasks[i]);
+    }
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_rejected() succeed\n");
+}
+
+
+int main()
+{
+    test_counters(TP_SCHED_SHARED);
+    test_counters(TP_SCHED_STEALING);
+    test_histograms();
+    test_rejected();
+
+    return 0;
+}
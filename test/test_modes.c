@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 2000
+#define THREAD_NUM 4
+
+
+volatile int g_runs = 0;
+
+
+void *task1(void *args)
+{
+    int i = *(int *) args;
+
+    if (i % 2 == 0) {
+        // posted from a worker
+        ++i;
+        assert(tp_post_task(tp_self(), tp_task_create(task1, NULL, &i, sizeof(int))));
+    }
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void run(tp_sched_t sched, tp_queue_kind_t kind)
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "run(sched=%d, queue=%d) started\n", sched, kind);
+
+    g_runs = 0;
+
+    tp_attr_init(&attr);
+    attr.sched = sched;
+    attr.queue_kind = kind;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    for (i = 0; i < TASK_NUM; i += 2) {
+        assert(tp_post_task(&tp, tp_task_create(task1, NULL, &i, sizeof(int))));
+    }
+
+    while (__atomic_load_n(&tp.active_tasks, __ATOMIC_ACQUIRE) > 0) {
+        usleep(1000);
+    }
+
+    assert(TASK_NUM == g_runs);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "run(sched=%d, queue=%d) succeed\n", sched, kind);
+}
+
+
+int main()
+{
+    run(TP_SCHED_SHARED, TP_QUEUE_LIST);
+    run(TP_SCHED_SHARED, TP_QUEUE_RING);
+    run(TP_SCHED_SHARED, TP_QUEUE_INTRUSIVE);
+    run(TP_SCHED_STEALING, TP_QUEUE_LIST);
+    run(TP_SCHED_STEALING, TP_QUEUE_RING);
+    run(TP_SCHED_STEALING, TP_QUEUE_INTRUSIVE);
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+#include "src/tp_topo.h"
+
+
+#define TASK_NUM 1000
+#define THREAD_NUM 4
+
+
+volatile int g_runs = 0;
+volatile int g_misplaced = 0;
+
+
+void test_parse()
+{
+    cpu_set_t set;
+
+    fprintf(stderr, "test_parse() started\n");
+
+    assert(tp_topo_parse_list("0-3,8,10-11\n", &set));
+    assert(7 == CPU_COUNT(&set));
+    assert(CPU_ISSET(8, &set) && !CPU_ISSET(9, &set) && CPU_ISSET(11, &set));
+
+    // memory-only nodes have no CPU
+    assert(tp_topo_parse_list("\n", &set));
+    assert(0 == CPU_COUNT(&set));
+
+    assert(!tp_topo_parse_list("3-1", &set));
+    assert(!tp_topo_parse_list("1,a", &set));
+    assert(!tp_topo_parse_list("1 2", &set));
+
+    assert(tp_topo_parse_list("2,5", &set));
+    assert(2 == tp_topo_nth_cpu(&set, 0));
+    assert(5 == tp_topo_nth_cpu(&set, 3));
+
+    fprintf(stderr, "test_parse() succeed\n");
+}
+
+
+void *pinned(void *args)
+{
+    int cpu = *(int *) args;
+    cpu_set_t set;
+
+    assert(0 == pthread_getaffinity_np(pthread_self(), sizeof(set), &set));
+
+    if (CPU_COUNT(&set) != 1 || !CPU_ISSET(cpu, &set) || sched_getcpu() != cpu) {
+        __sync_add_and_fetch(&g_misplaced, 1);
+    }
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void test_cpu_affinity()
+{
+    int i;
+    int cpu;
+    cpu_set_t allowed;
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_cpu_affinity() started\n");
+
+    assert(0 == sched_getaffinity(0, sizeof(allowed), &allowed));
+
+    for (cpu = 0; !CPU_ISSET(cpu, &allowed); ++cpu) {
+    }
+
+    tp_attr_init(&attr);
+    attr.affinity = TP_AFFINITY_CPU;
+    attr.cpus = &cpu;
+    attr.ncpus = 1;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    g_runs = 0;
+    g_misplaced = 0;
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(pinned, NULL, &cpu, sizeof(cpu))));
+    }
+
+    assert(tp_join_tasks(&tp));
+    assert(TASK_NUM == g_runs);
+    assert(0 == g_misplaced);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_cpu_affinity() succeed\n");
+}
+
+
+void *on_node(void *args)
+{
+    thread_pool_t *tp = *(thread_pool_t **) args;
+    cpu_set_t set;
+    int cpu = sched_getcpu();
+
+    // bound to the CPUs of one node
+    assert(0 == pthread_getaffinity_np(pthread_self(), sizeof(set), &set));
+
+    if (!CPU_ISSET(cpu, &set) || tp_topo_node_of(tp->topo, cpu) >= tp->nnode) {
+        __sync_add_and_fetch(&g_misplaced, 1);
+    }
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void test_numa()
+{
+    int i;
+    uint32_t node;
+    thread_pool_t tp;
+    thread_pool_t *ptp = &tp;
+    tp_attr_t attr;
+    tp_task_t *tasks[10];
+
+    fprintf(stderr, "test_numa() started\n");
+
+    tp_attr_init(&attr);
+    attr.numa = true;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp.nnode >= 1 && tp.nnode == tp.topo->nnode);
+
+    for (i = 0; i < THREAD_NUM; ++i) {
+        assert(tp.workers[i].node == (uint32_t) i % tp.nnode);
+    }
+
+    assert(tp_start(&tp));
+
+    g_runs = 0;
+    g_misplaced = 0;
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        node = (uint32_t) tp.topo->node_ids[i % tp.nnode];
+
+        // an unknown node is the same as any node
+        if (i % 7 == 0) {
+            node = i % 2 ? TP_NODE_ANY : 4096;
+        }
+
+        assert(tp_post_task_node(&tp, tp_task_create_pooled(&tp, on_node, NULL, &ptp, sizeof(ptp)), node));
+    }
+
+    for (i = 0; i < 10; ++i) {
+        tasks[i] = tp_task_create(on_node, NULL, &ptp, sizeof(ptp));
+        tasks[i]->node = (uint32_t) i % tp.nnode;
+    }
+
+    assert(10 == tp_post_tasks(&tp, tasks, 10));
+
+    assert(tp_join_tasks(&tp));
+    assert(TASK_NUM + 10 == g_runs);
+    assert(0 == g_misplaced);
+    assert(0 == tp_queue_len(&tp));
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_numa() succeed\n");
+}
+
+
+int main()
+{
+    test_parse();
+    test_cpu_affinity();
+    test_numa();
+
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+
+
+#define MAX_QUEUED 8
+#define TASK_NUM 64
+
+
+volatile int g_runs = 0;
+volatile int g_cleanups = 0;
+volatile int g_gate = 0;
+
+
+void cleanup1(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_cleanups, 1);
+}
+
+
+void *task1(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+// Keeps the only worker busy until the gate is opened
+void *blocker(void *args)
+{
+    UNUSED_PARAM(args);
+
+    while (!__atomic_load_n(&g_gate, __ATOMIC_ACQUIRE)) {
+        usleep(1000);
+    }
+
+    return NULL;
+}
+
+
+void init_pool(thread_pool_t *tp, tp_queue_kind_t kind, tp_overflow_t overflow, uint64_t timeout_us)
+{
+    tp_attr_t attr;
+
+    g_runs = 0;
+    g_cleanups = 0;
+    g_gate = 0;
+
+    tp_attr_init(&attr);
+    attr.queue_kind = kind;
+    attr.max_queued = MAX_QUEUED;
+    attr.overflow = overflow;
+    attr.overflow_timeout_us = timeout_us;
+
+    assert(tp_init_attr(tp, 1, &attr));
+    assert(tp_start(tp));
+
+    // the worker is busy, tasks stay queued
+    assert(tp_post_task(tp, tp_task_create(blocker, NULL, NULL, 0)));
+
+    while (tp_queue_len(tp) > 0) {
+        usleep(1000);
+    }
+}
+
+
+void fill(thread_pool_t *tp)
+{
+    int i;
+
+    for (i = 0; i < MAX_QUEUED; ++i) {
+        assert(tp_post_task(tp, tp_task_create(task1, cleanup1, NULL, 0)));
+    }
+
+    assert(MAX_QUEUED == tp_queue_len(tp));
+}
+
+
+void finish(thread_pool_t *tp)
+{
+    __atomic_store_n(&g_gate, 1, __ATOMIC_RELEASE);
+    assert(tp_join_tasks(tp));
+    tp_destroy(tp);
+}
+
+
+void test_fail(tp_queue_kind_t kind)
+{
+    int posted;
+    thread_pool_t tp;
+    tp_task_t *task;
+    tp_task_t *tasks[4];
+    tp_overflow_stats_t stats;
+
+    fprintf(stderr, "test_fail(%d) started\n", kind);
+
+    init_pool(&tp, kind, TP_OVERFLOW_FAIL, 0);
+    fill(&tp);
+
+    task = tp_task_create(task1, cleanup1, NULL, 0);
+    assert(!tp_post_task(&tp, task));
+    tp_task_free(task);
+
+    // a batch doesn't fit either
+    __atomic_store_n(&g_gate, 1, __ATOMIC_RELEASE);
+    assert(tp_join_tasks(&tp));
+    __atomic_store_n(&g_gate, 0, __ATOMIC_RELEASE);
+    assert(tp_post_task(&tp, tp_task_create(blocker, NULL, NULL, 0)));
+
+    while (tp_queue_len(&tp) > 0) {
+        usleep(1000);
+    }
+
+    fill(&tp);
+    tasks[0] = tp_task_create(task1, cleanup1, NULL, 0);
+    tasks[1] = tp_task_create(task1, cleanup1, NULL, 0);
+    posted = tp_post_tasks(&tp, tasks, 2);
+    assert(0 == posted);
+    tp_task_free(tasks[0]);
+    tp_task_free(tasks[1]);
+
+    tp_overflow_stats(&tp, &stats);
+    assert(3 == stats.rejected);
+    assert(0 == stats.blocked);
+
+    finish(&tp);
+    assert(2 * MAX_QUEUED == g_runs);
+
+    fprintf(stderr, "test_fail(%d) succeed\n", kind);
+}
+
+
+void test_caller_runs()
+{
+    int i;
+    thread_pool_t tp;
+    tp_overflow_stats_t stats;
+
+    fprintf(stderr, "test_caller_runs() started\n");
+
+    init_pool(&tp, TP_QUEUE_LIST, TP_OVERFLOW_CALLER_RUNS, 0);
+    fill(&tp);
+
+    // run right here, nothing is queued
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(task1, cleanup1, NULL, 0)));
+    }
+
+    assert(TASK_NUM == g_runs);
+    assert(MAX_QUEUED == tp_queue_len(&tp));
+
+    tp_overflow_stats(&tp, &stats);
+    assert(TASK_NUM == stats.caller_runs);
+
+    finish(&tp);
+    assert(TASK_NUM + MAX_QUEUED == g_runs);
+
+    fprintf(stderr, "test_caller_runs() succeed\n");
+}
+
+
+void test_drop_oldest(tp_queue_kind_t kind)
+{
+    int i;
+    thread_pool_t tp;
+    tp_group_t group;
+    tp_overflow_stats_t stats;
+
+    fprintf(stderr, "test_drop_oldest(%d) started\n", kind);
+
+    init_pool(&tp, kind, TP_OVERFLOW_DROP_OLDEST, 0);
+    tp_group_init(&group);
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_group_post(&tp, &group, tp_task_create(task1, cleanup1, NULL, 0)));
+    }
+
+    assert(MAX_QUEUED == tp_queue_len(&tp));
+    tp_overflow_stats(&tp, &stats);
+    assert(TASK_NUM - MAX_QUEUED == stats.dropped);
+    assert(TASK_NUM - MAX_QUEUED == g_cleanups);
+
+    finish(&tp);
+
+    // the dropped ones were counted down too
+    assert(0 == tp_group_pending(&group));
+    assert(MAX_QUEUED == g_runs);
+    assert(TASK_NUM == g_cleanups);
+
+    fprintf(stderr, "test_drop_oldest(%d) succeed\n", kind);
+}
+
+
+void *open_gate(void *args)
+{
+    UNUSED_PARAM(args);
+
+    usleep(20 * 1000);
+    __atomic_store_n(&g_gate, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+
+void test_block()
+{
+    int i;
+    thread_pool_t tp;
+    pthread_t thread;
+    tp_task_t *task;
+    tp_overflow_stats_t stats;
+
+    fprintf(stderr, "test_block() started\n");
+
+    // gives up after the timeout
+    init_pool(&tp, TP_QUEUE_RING, TP_OVERFLOW_BLOCK, 10 * 1000);
+    fill(&tp);
+
+    task = tp_task_create(task1, cleanup1, NULL, 0);
+    assert(!tp_post_task(&tp, task));
+    tp_task_free(task);
+
+    tp_overflow_stats(&tp, &stats);
+    assert(1 == stats.blocked);
+    assert(1 == stats.timed_out);
+    assert(1 == stats.rejected);
+
+    finish(&tp);
+
+    // waits until the workers made room
+    init_pool(&tp, TP_QUEUE_LIST, TP_OVERFLOW_BLOCK, TP_TIMEOUT_INFINITE);
+    fill(&tp);
+    assert(0 == pthread_create(&thread, NULL, open_gate, NULL));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(task1, cleanup1, NULL, 0)));
+        assert(tp_queue_len(&tp) <= MAX_QUEUED);
+    }
+
+    assert(0 == pthread_join(thread, NULL));
+
+    tp_overflow_stats(&tp, &stats);
+    fprintf(stderr, "blocked: %llu\n", (unsigned long long) stats.blocked);
+    assert(stats.blocked > 0);
+    assert(0 == stats.rejected);
+
+    finish(&tp);
+    assert(TASK_NUM + MAX_QUEUED == g_runs);
+
+    fprintf(stderr, "test_block() succeed\n");
+}
+
+
+int main()
+{
+    test_fail(TP_QUEUE_LIST);
+    test_fail(TP_QUEUE_RING);
+    test_fail(TP_QUEUE_INTRUSIVE);
+    test_caller_runs();
+    test_drop_oldest(TP_QUEUE_LIST);
+    test_drop_oldest(TP_QUEUE_INTRUSIVE);
+    test_block();
+
+    return 0;
+}
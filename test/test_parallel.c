@@ -0,0 +1,203 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread_pool.h"
+
+
+#define THREAD_NUM 4
+#define LEN 1000000
+#define NBIN 32
+
+
+uint32_t *g_hits;
+
+
+void mark(void *ctx, uint64_t begin, uint64_t end)
+{
+    uint64_t i;
+
+    UNUSED_PARAM(ctx);
+
+    for (i = begin; i < end; ++i) {
+        __sync_add_and_fetch(&g_hits[i], 1);
+    }
+}
+
+
+void sum_map(void *ctx, uint64_t begin, uint64_t end, void *acc)
+{
+    uint64_t i;
+
+    UNUSED_PARAM(ctx);
+
+    for (i = begin; i < end; ++i) {
+        *(uint64_t *) acc += i;
+    }
+}
+
+
+void sum_combine(void *ctx, void *acc, const void *other)
+{
+    UNUSED_PARAM(ctx);
+
+    *(uint64_t *) acc += *(const uint64_t *) other;
+}
+
+
+// Larger than the inline accumulator of a piece
+typedef struct
+{
+    uint64_t bins[NBIN];
+} histogram_t;
+
+
+void bin_map(void *ctx, uint64_t begin, uint64_t end, void *acc)
+{
+    uint64_t i;
+    histogram_t *hist = acc;
+
+    UNUSED_PARAM(ctx);
+
+    for (i = begin; i < end; ++i) {
+        ++hist->bins[i % NBIN];
+    }
+}
+
+
+void bin_combine(void *ctx, void *acc, const void *other)
+{
+    int i;
+    histogram_t *hist = acc;
+    const histogram_t *hist2 = other;
+
+    UNUSED_PARAM(ctx);
+
+    for (i = 0; i < NBIN; ++i) {
+        hist->bins[i] += hist2->bins[i];
+    }
+}
+
+
+void check_hits(uint64_t begin, uint64_t end)
+{
+    uint64_t i;
+
+    for (i = 0; i < LEN; ++i) {
+        assert(g_hits[i] == (i >= begin && i < end ? 1u : 0u));
+    }
+
+    memset(g_hits, 0, LEN * sizeof(uint32_t));
+}
+
+
+void test_for(thread_pool_t *tp)
+{
+    fprintf(stderr, "test_for() started\n");
+
+    assert(tp_parallel_for(tp, 0, LEN, 0, mark, NULL));
+    check_hits(0, LEN);
+
+    assert(tp_parallel_for(tp, 10, LEN - 10, 1000, mark, NULL));
+    check_hits(10, LEN - 10);
+
+    assert(tp_parallel_for(tp, 0, 1000, 1, mark, NULL));
+    check_hits(0, 1000);
+
+    assert(tp_parallel_for(tp, 5, 5, 0, mark, NULL));
+    check_hits(0, 0);
+
+    assert(!tp_parallel_for(tp, 6, 5, 0, mark, NULL));
+    assert(!tp_parallel_for(tp, 0, 5, 0, NULL, NULL));
+
+    fprintf(stderr, "test_for() succeed\n");
+}
+
+
+void test_reduce(thread_pool_t *tp)
+{
+    int i;
+    uint64_t sum;
+    uint64_t zero = 0;
+    histogram_t hist;
+    histogram_t empty;
+
+    fprintf(stderr, "test_reduce() started\n");
+
+    assert(tp_parallel_reduce(tp, 0, LEN, 0, sum_map, sum_combine,
+                              &zero, sizeof(zero), &sum, NULL));
+    assert((uint64_t) LEN * (LEN - 1) / 2 == sum);
+
+    assert(tp_parallel_reduce(tp, 0, 0, 0, sum_map, sum_combine,
+                              &zero, sizeof(zero), &sum, NULL));
+    assert(0 == sum);
+
+    memset(&empty, 0, sizeof(empty));
+    assert(tp_parallel_reduce(tp, 0, LEN, 100, bin_map, bin_combine,
+                              &empty, sizeof(empty), &hist, NULL));
+
+    for (i = 0; i < NBIN; ++i) {
+        assert(LEN / NBIN + (i < LEN % NBIN) == hist.bins[i]);
+    }
+
+    fprintf(stderr, "test_reduce() succeed\n");
+}
+
+
+// A loop inside a task, its caller is a worker
+void *nested(void *args)
+{
+    thread_pool_t *tp = tp_self();
+
+    UNUSED_PARAM(args);
+
+    assert(tp_parallel_for(tp, 0, LEN, 100, mark, NULL));
+
+    return NULL;
+}
+
+
+void test_nested(thread_pool_t *tp)
+{
+    fprintf(stderr, "test_nested() started\n");
+
+    assert(tp_post_task(tp, tp_task_create(nested, NULL, NULL, 0)));
+    tp_join_tasks(tp);
+    check_hits(0, LEN);
+
+    fprintf(stderr, "test_nested() succeed\n");
+}
+
+
+int main()
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    g_hits = calloc(LEN, sizeof(uint32_t));
+    assert(g_hits);
+
+    // the caller runs everything before the pool is started
+    assert(tp_init(&tp, THREAD_NUM));
+    test_for(&tp);
+    test_reduce(&tp);
+    assert(tp_start(&tp));
+    test_for(&tp);
+    test_reduce(&tp);
+    test_nested(&tp);
+    tp_destroy(&tp);
+
+    tp_attr_init(&attr);
+    attr.sched = TP_SCHED_STEALING;
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+    test_for(&tp);
+    test_reduce(&tp);
+    test_nested(&tp);
+    tp_destroy(&tp);
+
+    free(g_hits);
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 30
+
+
+int g_order[TASK_NUM];
+volatile int g_runs = 0;
+
+
+void *task1(void *args)
+{
+    int prio = *(int *) args;
+
+    g_order[__sync_fetch_and_add(&g_runs, 1)] = prio;
+
+    return NULL;
+}
+
+
+tp_task_t *create_task(int prio)
+{
+    tp_task_t *task = tp_task_create(task1, NULL, &prio, sizeof(prio));
+
+    assert(task);
+    tp_task_set_priority(task, (uint32_t) prio);
+
+    return task;
+}
+
+
+/**
+ * Queue the tasks before starting the only worker,
+ * so the order they run in is decided by the scheduler alone.
+ */
+void test_order(tp_queue_kind_t kind)
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_priority_stats_t stats;
+    tp_task_t *tasks[TASK_NUM / 3];
+
+    fprintf(stderr, "test_order(%d) started\n", kind);
+
+    tp_attr_init(&attr);
+    attr.queue_kind = kind;
+    attr.priority_aging = 0;
+
+    assert(tp_init_attr(&tp, 1, &attr));
+    g_runs = 0;
+
+    for (i = 0; i < TASK_NUM / 3; ++i) {
+        assert(tp_post_task(&tp, create_task(TP_PRIORITY_LOW)));
+    }
+
+    for (i = 0; i < TASK_NUM / 3; ++i) {
+        assert(tp_post_task_priority(&tp, create_task(TP_PRIORITY_NORMAL), TP_PRIORITY_NORMAL));
+    }
+
+    for (i = 0; i < TASK_NUM / 3; ++i) {
+        tasks[i] = create_task(TP_PRIORITY_HIGH);
+    }
+
+    assert(TASK_NUM / 3 == tp_post_tasks(&tp, tasks, TASK_NUM / 3));
+
+    assert(TASK_NUM == tp_queue_len(&tp));
+    tp_priority_stats(&tp, TP_PRIORITY_HIGH, &stats);
+    assert(TASK_NUM / 3 == stats.depth && TASK_NUM / 3 == stats.high_water);
+
+    assert(tp_start(&tp));
+    assert(tp_join_tasks(&tp));
+    assert(TASK_NUM == g_runs);
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(g_order[i] == i / (TASK_NUM / 3));
+    }
+
+    tp_priority_stats(&tp, TP_PRIORITY_LOW, &stats);
+    assert(0 == stats.depth && TASK_NUM / 3 == stats.high_water && 0 == stats.aged);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_order(%d) succeed\n", kind);
+}
+
+
+void test_aging()
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_priority_stats_t stats;
+
+    fprintf(stderr, "test_aging() started\n");
+
+    tp_attr_init(&attr);
+    attr.priority_aging = 4;
+
+    assert(tp_init_attr(&tp, 1, &attr));
+    g_runs = 0;
+
+    assert(tp_post_task(&tp, create_task(TP_PRIORITY_LOW)));
+
+    for (i = 1; i < TASK_NUM; ++i) {
+        assert(tp_post_task(&tp, create_task(TP_PRIORITY_HIGH)));
+    }
+
+    assert(tp_start(&tp));
+    assert(tp_join_tasks(&tp));
+
+    // served after passing over it `priority_aging` times
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(g_order[i] == (i == 4 ? TP_PRIORITY_LOW : TP_PRIORITY_HIGH));
+    }
+
+    tp_priority_stats(&tp, TP_PRIORITY_LOW, &stats);
+    assert(1 == stats.aged);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_aging() succeed\n");
+}
+
+
+void test_classes()
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_priority_stats_t stats;
+
+    fprintf(stderr, "test_classes() started\n");
+
+    tp_attr_init(&attr);
+    attr.npriority = 5;
+    attr.priority_aging = 0;
+
+    assert(tp_init_attr(&tp, 1, &attr));
+    g_runs = 0;
+
+    // out of range classes fall into the lowest one
+    for (i = TASK_NUM - 1; i >= 0; --i) {
+        assert(tp_post_task(&tp, create_task(i % 6)));
+    }
+
+    tp_priority_stats(&tp, 4, &stats);
+    assert(2 * TASK_NUM / 6 == stats.depth);
+
+    assert(tp_start(&tp));
+    assert(tp_join_tasks(&tp));
+
+    for (i = 1; i < TASK_NUM; ++i) {
+        assert((g_order[i - 1] < 4 ? g_order[i - 1] : 4) <= (g_order[i] < 4 ? g_order[i] : 4));
+    }
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_classes() succeed\n");
+}
+
+
+int main()
+{
+    test_order(TP_QUEUE_LIST);
+    test_order(TP_QUEUE_RING);
+    test_order(TP_QUEUE_INTRUSIVE);
+    test_aging();
+    test_classes();
+
+    return 0;
+}
@@ -93,12 +93,58 @@ void test_len()
 }
 
 
+void test_append()
+{
+    int i;
+    qdata_t qdata;
+    queue_t queue;
+    queue_t other;
+
+    fprintf(stderr, "test_append() started\n");
+
+    assert(queue_init(&queue));
+    assert(queue_init(&other));
+
+    // appending an empty queue
+    assert(queue_append(&queue, &other));
+    assert(0 == queue_len(&queue));
+
+    for (i = 0; i < LEN; ++i) {
+        qdata.i32 = data[i];
+        assert(queue_enqueue(i < LEN / 2 ? &queue : &other, qdata));
+    }
+
+    assert(queue_append(&queue, &other));
+    assert(LEN == queue_len(&queue));
+    assert(0 == queue_len(&other));
+    assert(NULL == other.head);
+    assert(NULL == other.tail);
+
+    for (i = 0; i < LEN; ++i) {
+        assert(queue_dequeue(&queue, &qdata));
+        assert(data[i] == qdata.i32);
+    }
+
+    // appending to an empty queue
+    qdata.i32 = 1;
+    assert(queue_enqueue(&other, qdata));
+    assert(queue_append(&queue, &other));
+    assert(1 == queue_len(&queue));
+    assert(queue.head == queue.tail);
+
+    queue_clear(&queue);
+
+    fprintf(stderr, "test_append() succeed\n");
+}
+
+
 void test_queue()
 {
     init_data();
     test_init();
     test_destroy();
     test_len();
+    test_append();
 }
 
 
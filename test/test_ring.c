@@ -0,0 +1,189 @@
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LEN 100000
+#define NPRODUCER 2
+#define NCONSUMER 2
+#define CAPACITY 256
+#define TASK_NUM 1000
+
+
+ring_t g_ring;
+volatile int g_consumed = 0;
+int g_taken[LEN * NPRODUCER];
+
+
+void test_single()
+{
+    int i;
+    qdata_t qdata;
+    ring_t ring;
+
+    fprintf(stderr, "test_single() started\n");
+
+    assert(ring_init(&ring, 100));
+    assert(128 == ring_capacity(&ring));
+    assert(ring_isempty(&ring));
+
+    // wrap around several laps
+    for (i = 0; i < 1000; ++i) {
+        qdata.i32 = i;
+        assert(ring_enqueue(&ring, qdata));
+        assert(ring_dequeue(&ring, &qdata));
+        assert(i == qdata.i32);
+    }
+
+    for (i = 0; i < 128; ++i) {
+        qdata.i32 = i;
+        assert(ring_enqueue(&ring, qdata));
+    }
+
+    assert(!ring_enqueue(&ring, qdata));
+    assert(128 == ring_len(&ring));
+
+    for (i = 0; i < 128; ++i) {
+        assert(ring_dequeue(&ring, &qdata));
+        assert(i == qdata.i32);
+    }
+
+    assert(!ring_dequeue(&ring, &qdata));
+
+    ring_destroy(&ring);
+
+    fprintf(stderr, "test_single() succeed\n");
+}
+
+
+void *producer(void *args)
+{
+    int i;
+    int base = *(int *) args;
+    qdata_t qdata;
+
+    for (i = 0; i < LEN; ++i) {
+        qdata.i32 = base + i;
+        while (!ring_enqueue(&g_ring, qdata)) {}
+    }
+
+    return NULL;
+}
+
+
+void *consumer(void *args)
+{
+    qdata_t qdata;
+
+    (void) args;
+
+    while (__atomic_load_n(&g_consumed, __ATOMIC_RELAXED) < LEN * NPRODUCER) {
+        if (ring_dequeue(&g_ring, &qdata)) {
+            __sync_add_and_fetch(&g_taken[qdata.i32], 1);
+            __sync_add_and_fetch(&g_consumed, 1);
+        }
+    }
+
+    return NULL;
+}
+
+
+void test_concurrent()
+{
+    int i;
+    int bases[NPRODUCER];
+    pthread_t producers[NPRODUCER];
+    pthread_t consumers[NCONSUMER];
+
+    fprintf(stderr, "test_concurrent() started\n");
+
+    assert(ring_init(&g_ring, CAPACITY));
+
+    for (i = 0; i < NCONSUMER; ++i) {
+        assert(0 == pthread_create(&consumers[i], NULL, consumer, NULL));
+    }
+
+    for (i = 0; i < NPRODUCER; ++i) {
+        bases[i] = i * LEN;
+        assert(0 == pthread_create(&producers[i], NULL, producer, &bases[i]));
+    }
+
+    for (i = 0; i < NPRODUCER; ++i) {
+        pthread_join(producers[i], NULL);
+    }
+
+    for (i = 0; i < NCONSUMER; ++i) {
+        pthread_join(consumers[i], NULL);
+    }
+
+    for (i = 0; i < LEN * NPRODUCER; ++i) {
+        assert(1 == g_taken[i]);
+    }
+
+    ring_destroy(&g_ring);
+
+    fprintf(stderr, "test_concurrent() succeed\n");
+}
+
+
+volatile int g_runs = 0;
+
+
+void *task(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void test_pool()
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_pool() started\n");
+
+    tp_attr_init(&attr);
+    attr.queue_kind = TP_QUEUE_RING;
+    attr.queue_capacity = CAPACITY;
+
+    assert(tp_init_attr(&tp, 4, &attr));
+    assert(tp_start(&tp));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        tp_task_t *t = tp_task_create(task, NULL, NULL, 0);
+
+        // the ring is bounded, retry when it's full
+        while (!tp_post_task(&tp, t)) {
+            usleep(100);
+        }
+    }
+
+    while (__atomic_load_n(&tp.active_tasks, __ATOMIC_ACQUIRE) > 0) {
+        usleep(1000);
+    }
+
+    assert(TASK_NUM == g_runs);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_pool() succeed\n");
+}
+
+
+int main()
+{
+    test_single();
+    test_concurrent();
+    test_pool();
+
+    return 0;
+}
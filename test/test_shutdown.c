@@ -0,0 +1,263 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 100
+#define THREAD_NUM 2
+
+
+volatile int g_runs = 0;
+volatile int g_cleanups = 0;
+volatile int g_posted = -1;
+
+
+void cleanup1(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_cleanups, 1);
+}
+
+
+void *task1(void *args)
+{
+    useconds_t *us = args;
+
+    usleep(*us);
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void *quick(void *args)
+{
+    UNUSED_PARAM(args);
+
+    return NULL;
+}
+
+
+void *repost(void *args)
+{
+    thread_pool_t *tp = *(thread_pool_t **) args;
+    tp_task_t *task = tp_task_create(quick, cleanup1, NULL, 0);
+
+    while (!__atomic_load_n(&tp->stopping, __ATOMIC_ACQUIRE)) {
+        usleep(100);
+    }
+
+    g_posted = tp_post_task(tp, task);
+
+    if (!g_posted) {
+        tp_task_free(task);
+    }
+
+    return NULL;
+}
+
+
+void post_tasks(thread_pool_t *tp, tp_group_t *group, useconds_t us)
+{
+    int i;
+
+    g_runs = 0;
+    g_cleanups = 0;
+    tp_group_init(group);
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_group_post(tp, group, tp_task_create(task1, cleanup1, &us, sizeof(us))));
+    }
+}
+
+
+void wait_started(thread_pool_t *tp)
+{
+    // some tasks are running, the others are queued
+    while (tp_queue_len(tp) == TASK_NUM) {
+        usleep(100);
+    }
+}
+
+
+void test_drain_queued(tp_sched_t sched)
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+    tp_group_t group;
+
+    fprintf(stderr, "test_drain_queued(%d) started\n", sched);
+
+    tp_attr_init(&attr);
+    attr.sched = sched;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    post_tasks(&tp, &group, 100);
+
+    assert(tp_shutdown(&tp, TP_DRAIN_QUEUED, TP_TIMEOUT_INFINITE));
+    assert(TASK_NUM == g_runs);
+    assert(TASK_NUM == g_cleanups);
+    assert(0 == tp_group_pending(&group));
+    assert(0 == tp_live_threads(&tp));
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_drain_queued(%d) succeed\n", sched);
+}
+
+
+void test_drain_running(tp_drain_t drain)
+{
+    thread_pool_t tp;
+    tp_group_t group;
+
+    fprintf(stderr, "test_drain_running(%d) started\n", drain);
+
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+
+    post_tasks(&tp, &group, 10 * 1000);
+    wait_started(&tp);
+
+    // the running tasks are finished, the queued ones are only freed
+    assert(tp_shutdown(&tp, drain, TP_TIMEOUT_INFINITE));
+    fprintf(stderr, "runs: %d, cleanups: %d\n", g_runs, g_cleanups);
+    assert(g_runs > 0 && g_runs < TASK_NUM);
+    assert(0 == tp_group_pending(&group));
+    assert(0 == tp_queue_len(&tp));
+    assert(0 == tp.active_tasks);
+
+    if (drain == TP_DRAIN_DISCARD) {
+        assert(TASK_NUM == g_cleanups);
+    } else {
+        assert(g_runs == g_cleanups);
+    }
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_drain_running(%d) succeed\n", drain);
+}
+
+
+void test_deadline()
+{
+    thread_pool_t tp;
+    tp_group_t group;
+    tp_future_t *future;
+
+    fprintf(stderr, "test_deadline() started\n");
+
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+
+    post_tasks(&tp, &group, 10 * 1000);
+    future = tp_post_task_future(&tp, tp_task_create(quick, NULL, NULL, 0));
+    assert(future);
+
+    // draining would take 500ms
+    assert(!tp_shutdown(&tp, TP_DRAIN_QUEUED, 30 * 1000));
+    assert(tp_shutdown(&tp, TP_DRAIN_QUEUED, TP_TIMEOUT_INFINITE));
+
+    fprintf(stderr, "runs: %d, cleanups: %d\n", g_runs, g_cleanups);
+    assert(g_runs < TASK_NUM);
+    assert(TASK_NUM == g_cleanups);
+    assert(0 == tp_group_pending(&group));
+    assert(tp_future_cancelled(future));
+    tp_future_release(future);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_deadline() succeed\n");
+}
+
+
+void test_restart()
+{
+    int i;
+    thread_pool_t tp;
+    tp_group_t group;
+
+    fprintf(stderr, "test_restart() started\n");
+
+    assert(!tp_start(NULL));
+    assert(tp_init(&tp, THREAD_NUM));
+
+    for (i = 0; i < 10; ++i) {
+        assert(tp_start(&tp));
+        // starting it again fails without stopping the workers
+        assert(!tp_start(&tp));
+        assert(!tp.stopping);
+
+        post_tasks(&tp, &group, 100);
+        assert(tp_post_delayed(&tp, tp_task_create(quick, cleanup1, NULL, 0), 1000000));
+
+        assert(tp_shutdown(&tp, i % 2 ? TP_DRAIN_DISCARD : TP_DRAIN_QUEUED, TP_TIMEOUT_INFINITE));
+        assert(0 == tp_group_pending(&group));
+        assert(i % 2 || TASK_NUM == g_runs);
+        // the pending timer is discarded as well
+        assert(TASK_NUM + 1 == g_cleanups);
+    }
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_restart() succeed\n");
+}
+
+
+void test_post_stopped()
+{
+    thread_pool_t tp;
+    thread_pool_t *self = &tp;
+    tp_task_t *tasks[2];
+
+    fprintf(stderr, "test_post_stopped() started\n");
+
+    g_cleanups = 0;
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+
+    // a task being drained can't post any more
+    assert(tp_post_task(&tp, tp_task_create(repost, NULL, &self, sizeof(self))));
+    assert(tp_shutdown(&tp, TP_DRAIN_QUEUED, TP_TIMEOUT_INFINITE));
+    assert(0 == g_posted);
+
+    // nor anyone else until it's restarted, the tasks are left to the caller
+    tasks[0] = tp_task_create(quick, cleanup1, NULL, 0);
+    tasks[1] = tp_task_create(quick, cleanup1, NULL, 0);
+    assert(!tp_post_task(&tp, tasks[0]));
+    assert(0 == tp_post_tasks(&tp, tasks, 2));
+    assert(NULL == tp_post_task_future(&tp, tasks[0]));
+    assert(!tp_post_delayed(&tp, tasks[0], 0));
+    assert(0 == tp.active_tasks);
+    assert(0 == tp_queue_len(&tp));
+    assert(0 == g_cleanups);
+
+    assert(tp_start(&tp));
+    assert(2 == tp_post_tasks(&tp, tasks, 2));
+    assert(tp_shutdown(&tp, TP_DRAIN_QUEUED, TP_TIMEOUT_INFINITE));
+    assert(2 == g_cleanups);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_post_stopped() succeed\n");
+}
+
+
+int main()
+{
+    test_drain_queued(TP_SCHED_SHARED);
+    test_drain_queued(TP_SCHED_STEALING);
+    test_drain_running(TP_DRAIN_RUNNING);
+    test_drain_running(TP_DRAIN_DISCARD);
+    test_deadline();
+    test_restart();
+    test_post_stopped();
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 10000
+#define THREAD_NUM 4
+
+
+volatile int g_runs = 0;
+
+
+void *child(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void *parent(void *args)
+{
+    thread_pool_t *tp = tp_self();
+    tp_task_t *task;
+
+    UNUSED_PARAM(args);
+
+    // allocated from the worker's private cache
+    task = tp_task_create_pooled(tp, child, NULL, NULL, 0);
+    assert(task);
+    assert(task->owner == tp);
+    assert(tp_post_task(tp, task));
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void test_slab()
+{
+    int i;
+    thread_pool_t tp;
+    tp_task_t *task;
+    tp_task_stats_t stats;
+
+    assert(tp_init(&tp, THREAD_NUM));
+
+    // allocating and freeing on the same thread reuses the same task
+    task = tp_task_create_pooled(&tp, child, NULL, &i, sizeof(int));
+    assert(task);
+    tp_task_free_pooled(task);
+    assert(task == tp_task_create_pooled(&tp, child, NULL, &i, sizeof(int)));
+    tp_task_free(task);
+
+    assert(tp_start(&tp));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        task = tp_task_create_pooled(&tp, parent, NULL, &i, sizeof(int));
+        assert(task);
+        assert(tp_post_task(&tp, task));
+    }
+
+    while (__atomic_load_n(&tp.active_tasks, __ATOMIC_ACQUIRE) > 0) {
+        usleep(1000);
+    }
+
+    assert(2 * TASK_NUM == g_runs);
+
+    tp_task_stats(&tp, &stats);
+
+    fprintf(stderr, "local hits: %llu, shared hits: %llu, misses: %llu\n"
+                    "local frees: %llu, remote frees: %llu, slabs: %llu\n",
+            (unsigned long long) stats.local_hits,
+            (unsigned long long) stats.shared_hits,
+            (unsigned long long) stats.misses,
+            (unsigned long long) stats.local_frees,
+            (unsigned long long) stats.remote_frees,
+            (unsigned long long) stats.slabs);
+
+    assert(stats.local_hits + stats.shared_hits + stats.misses == 2 * TASK_NUM + 2);
+    assert(stats.local_frees + stats.remote_frees == 2 * TASK_NUM + 2);
+    assert(stats.misses == stats.slabs);
+    // the tasks are recycled instead of being allocated again
+    assert(stats.local_hits + stats.shared_hits > stats.misses);
+
+    tp_destroy(&tp);
+}
+
+
+void test_slab_node()
+{
+    int i;
+    thread_pool_t tp;
+    tp_task_t *task;
+    tp_task_t **free_tasks;
+    tp_task_t *lists[2] = {NULL, NULL};
+
+    fprintf(stderr, "test_slab_node() started\n");
+
+    assert(tp_init(&tp, THREAD_NUM));
+
+    // Pretend there are two nodes, the task coming from a slab of node 1
+    free_tasks = tp.free_tasks;
+    tp.free_tasks = lists;
+
+    task = tp_task_create_pooled(&tp, child, NULL, &i, sizeof(int));
+    assert(task);
+    task->slab_node = 1;
+
+    // back to the free list of its own node, still knowing it
+    tp_task_free(task);
+    assert(lists[1] == task);
+    assert(lists[0] != task);
+    assert(task->slab_node == 1);
+
+    // the slab was grown on node 0, where the test runs
+    tp.free_tasks = free_tasks;
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_slab_node() succeed\n");
+}
+
+
+int main()
+{
+    test_slab();
+    test_slab_node();
+
+    return 0;
+}
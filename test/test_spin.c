@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define TASK_NUM 200
+#define THREAD_NUM 2
+
+
+volatile int g_runs = 0;
+
+
+void *task1(void *args)
+{
+    UNUSED_PARAM(args);
+
+    __sync_add_and_fetch(&g_runs, 1);
+
+    return NULL;
+}
+
+
+void post_with_gap(thread_pool_t *tp, useconds_t gap)
+{
+    int i;
+
+    g_runs = 0;
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(tp, tp_task_create(task1, NULL, NULL, 0)));
+        usleep(gap);
+    }
+
+    assert(tp_join_tasks(tp));
+    assert(TASK_NUM == g_runs);
+}
+
+
+void test_spin()
+{
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_spin() started\n");
+
+    tp_attr_init(&attr);
+    attr.spin_us = 200 * 1000;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    // the workers keep polling between the posts instead of parking
+    post_with_gap(&tp, 100);
+
+    fprintf(stderr, "wake calls: %llu\n", (unsigned long long) tp.wake_calls);
+    assert(tp.wake_calls < TASK_NUM / 2);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_spin() succeed\n");
+}
+
+
+void test_adaptive()
+{
+    uint32_t i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_adaptive() started\n");
+
+    tp_attr_init(&attr);
+    attr.spin_us = 100;
+    attr.spin_adaptive = true;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    // gaps much longer than the spin budget
+    post_with_gap(&tp, 2000);
+
+    for (i = 0; i < tp.nthread; ++i) {
+        fprintf(stderr, "worker %u idle ewma: %lluns\n", i,
+                (unsigned long long) tp.workers[i].idle_ewma_ns);
+    }
+
+    // learned the gaps are too long to be worth spinning
+    assert(tp.workers[0].idle_ewma_ns > attr.spin_us * 1000
+           || tp.workers[1].idle_ewma_ns > attr.spin_us * 1000);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_adaptive() succeed\n");
+}
+
+
+int main()
+{
+    test_spin();
+    test_adaptive();
+
+    return 0;
+}
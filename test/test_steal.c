@@ -0,0 +1,68 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define DEPTH 12
+#define THREAD_NUM 4
+
+
+volatile int g_leaves = 0;
+
+
+void *split(void *args)
+{
+    int depth = *(int *) args;
+    thread_pool_t *tp;
+
+    if (depth == 0) {
+        __sync_add_and_fetch(&g_leaves, 1);
+        return NULL;
+    }
+
+    // posted from a worker, so they go to its own deque
+    --depth;
+    tp = tp_self();
+    assert(tp_post_task(tp, tp_task_create(split, NULL, &depth, sizeof(int))));
+    assert(tp_post_task(tp, tp_task_create(split, NULL, &depth, sizeof(int))));
+
+    return NULL;
+}
+
+
+void test_steal()
+{
+    int depth = DEPTH;
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    tp_attr_init(&attr);
+    attr.sched = TP_SCHED_STEALING;
+    // small enough to exercise the overflow to the shared queue
+    attr.deque_capacity = 64;
+
+    assert(tp_init_attr(&tp, THREAD_NUM, &attr));
+    assert(tp_start(&tp));
+
+    assert(tp_post_task(&tp, tp_task_create(split, NULL, &depth, sizeof(int))));
+
+    while (__atomic_load_n(&tp.active_tasks, __ATOMIC_ACQUIRE) > 0) {
+        usleep(1000);
+    }
+
+    fprintf(stderr, "leaves: %d\n", g_leaves);
+    assert(g_leaves == 1 << DEPTH);
+
+    tp_destroy(&tp);
+}
+
+
+int main()
+{
+    test_steal();
+
+    return 0;
+}
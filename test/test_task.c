@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread_pool.h"
+
+
+#define BIG_LEN (TP_TASK_INLINE_ARGS * 4)
+
+
+struct small_args_s
+{
+    int index;
+    double value;
+    void *ptr;
+};
+
+
+volatile int g_checked = 0;
+
+
+void *check_small(void *args)
+{
+    struct small_args_s *a = args;
+
+    assert(a->index == 42);
+    assert(a->value == 0.5);
+    assert(a->ptr == &g_checked);
+
+    __sync_add_and_fetch(&g_checked, 1);
+
+    return NULL;
+}
+
+
+void *check_big(void *args)
+{
+    int i;
+    char *a = args;
+
+    for (i = 0; i < BIG_LEN; ++i) {
+        assert(a[i] == (char) i);
+    }
+
+    __sync_add_and_fetch(&g_checked, 1);
+
+    return NULL;
+}
+
+
+void test_storage()
+{
+    int i;
+    char big[BIG_LEN];
+    struct small_args_s small;
+    tp_task_t *task;
+
+    fprintf(stderr, "test_storage() started\n");
+
+    small.index = 42;
+    small.value = 0.5;
+    small.ptr = (void *) &g_checked;
+
+    for (i = 0; i < BIG_LEN; ++i) {
+        big[i] = (char) i;
+    }
+
+    // copied into the task itself
+    task = tp_task_create(check_small, NULL, &small, sizeof(small));
+    assert(task);
+    assert(task->args == (void *) task->inline_args.buf);
+    assert(0 == memcmp(task->args, &small, sizeof(small)));
+    tp_task_free(task);
+
+    // too large, copied to the heap
+    task = tp_task_create(check_big, NULL, big, sizeof(big));
+    assert(task);
+    assert(task->args != (void *) task->inline_args.buf);
+    assert(task->args != (void *) big);
+    assert(0 == memcmp(task->args, big, sizeof(big)));
+    tp_task_free(task);
+
+    // not copied at all
+    task = tp_task_create(check_big, NULL, big, 0);
+    assert(task);
+    assert(task->args == (void *) big);
+    tp_task_free(task);
+
+    fprintf(stderr, "test_storage() succeed\n");
+}
+
+
+void test_run()
+{
+    int i;
+    char big[BIG_LEN];
+    struct small_args_s small;
+    thread_pool_t tp;
+
+    fprintf(stderr, "test_run() started\n");
+
+    small.index = 42;
+    small.value = 0.5;
+    small.ptr = (void *) &g_checked;
+
+    for (i = 0; i < BIG_LEN; ++i) {
+        big[i] = (char) i;
+    }
+
+    assert(tp_init(&tp, 2));
+    assert(tp_start(&tp));
+
+    assert(tp_post_task(&tp, tp_task_create(check_small, NULL, &small, sizeof(small))));
+    assert(tp_post_task(&tp, tp_task_create(check_big, NULL, big, sizeof(big))));
+
+    while (g_checked < 2) {
+        usleep(1000);
+    }
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_run() succeed\n");
+}
+
+
+int main()
+{
+    test_storage();
+    test_run();
+
+    return 0;
+}
@@ -0,0 +1,267 @@
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+
+#define THREAD_NUM 4
+#define TIMER_NUM 10000
+// latest a timer may fire, generous for loaded hosts
+#define MAX_LATE_US 200000
+
+
+typedef struct
+{
+    uint64_t due_ns;
+    int id;
+} timer_arg_t;
+
+
+volatile int g_runs = 0;
+volatile uint64_t g_max_late_ns = 0;
+int g_order[10];
+
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+
+void *delayed(void *args)
+{
+    timer_arg_t *arg = args;
+    uint64_t now = now_ns();
+    uint64_t late;
+
+    assert(now >= arg->due_ns);
+    late = now - arg->due_ns;
+
+    while (late > g_max_late_ns) {
+        g_max_late_ns = late;
+    }
+
+    g_order[__sync_fetch_and_add(&g_runs, 1) % 10] = arg->id;
+
+    return NULL;
+}
+
+
+void wait_runs(int n)
+{
+    while (g_runs < n) {
+        usleep(1000);
+    }
+}
+
+
+tp_task_t *create_delayed(int id, uint64_t delay_us)
+{
+    timer_arg_t arg;
+
+    arg.due_ns = now_ns() + delay_us * 1000;
+    arg.id = id;
+
+    return tp_task_create(delayed, NULL, &arg, sizeof(arg));
+}
+
+
+void test_order()
+{
+    int i;
+    thread_pool_t tp;
+
+    fprintf(stderr, "test_order() started\n");
+
+    assert(tp_init(&tp, 1));
+    assert(tp_start(&tp));
+
+    g_runs = 0;
+
+    // posted from the latest to the earliest
+    for (i = 9; i >= 0; --i) {
+        assert(tp_post_delayed(&tp, create_delayed(i, (uint64_t) (i + 1) * 5000), (uint64_t) (i + 1) * 5000));
+    }
+
+    wait_runs(10);
+
+    for (i = 0; i < 10; ++i) {
+        assert(g_order[i] == i);
+    }
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_order() succeed\n");
+}
+
+
+void test_many()
+{
+    int i;
+    uint64_t delay;
+    thread_pool_t tp;
+
+    fprintf(stderr, "test_many() started\n");
+
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+
+    g_runs = 0;
+    g_max_late_ns = 0;
+    srand(1);
+
+    for (i = 0; i < TIMER_NUM; ++i) {
+        delay = (uint64_t) (rand() % 100000);
+        assert(tp_post_delayed(&tp, create_delayed(i, delay), delay));
+    }
+
+    wait_runs(TIMER_NUM);
+    assert(tp_join_tasks(&tp));
+
+    fprintf(stderr, "max lateness: %lluus\n", (unsigned long long) g_max_late_ns / 1000);
+    assert(g_max_late_ns <= MAX_LATE_US * 1000ull);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_many() succeed\n");
+}
+
+
+typedef struct
+{
+    tp_task_t *task;
+    int limit;
+    uint64_t interval_ns;
+    // due time of the previous run, 0 before the first one
+    uint64_t last_due_ns;
+} periodic_arg_t;
+
+
+void *periodic(void *args)
+{
+    periodic_arg_t *arg = args;
+    uint64_t now = now_ns();
+    // due time of this run, moved to the next one after it returns
+    uint64_t due = arg->task->due_ns;
+
+    // never early, never much late
+    assert(now >= due);
+    assert(now - due <= MAX_LATE_US * 1000ull);
+
+    // on the fixed rate grid, at most once per period
+    if (arg->last_due_ns) {
+        assert(due > arg->last_due_ns);
+        assert((due - arg->last_due_ns) % arg->interval_ns == 0);
+    }
+
+    arg->last_due_ns = due;
+
+    if (__sync_add_and_fetch(&g_runs, 1) == arg->limit) {
+        tp_cancel_periodic(arg->task);
+    }
+
+    return NULL;
+}
+
+
+void periodic_init(periodic_arg_t *arg, int limit, uint64_t interval_us)
+{
+    arg->limit = limit;
+    arg->interval_ns = interval_us * 1000;
+    arg->last_due_ns = 0;
+    arg->task = tp_task_create(periodic, NULL, arg, 0);
+}
+
+
+void test_periodic()
+{
+    int runs;
+    thread_pool_t tp;
+    periodic_arg_t arg;
+
+    fprintf(stderr, "test_periodic() started\n");
+
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+
+    g_runs = 0;
+
+    // args are passed as is, so the task can cancel itself
+    periodic_init(&arg, 20, 2000);
+    assert(!tp_post_periodic(&tp, arg.task, 0, 0));
+    assert(tp_post_periodic(&tp, arg.task, 1000, 2000));
+
+    // cancelled by itself after the 20th run
+    wait_runs(arg.limit);
+    usleep(20000);
+    assert(arg.limit == g_runs);
+
+    // cancelled from outside, nothing runs after the one in progress
+    g_runs = 0;
+    periodic_init(&arg, -1, 5000);
+    assert(tp_post_periodic(&tp, arg.task, 0, 5000));
+
+    wait_runs(5);
+    tp_cancel_periodic(arg.task);
+    usleep(20000);
+    runs = g_runs;
+    usleep(20000);
+
+    assert(runs == g_runs);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_periodic() succeed\n");
+}
+
+
+void test_destroy()
+{
+    int i;
+    thread_pool_t tp;
+    tp_group_t group;
+    periodic_arg_t arg;
+    tp_task_t *task;
+
+    fprintf(stderr, "test_destroy() started\n");
+
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+
+    tp_group_init(&group);
+    tp_group_add(&group, 10);
+
+    for (i = 0; i < 10; ++i) {
+        task = create_delayed(i, 1000000);
+        task->group = &group;
+        assert(tp_post_delayed(&tp, task, 1000000));
+    }
+
+    periodic_init(&arg, -1, 1000);
+    assert(tp_post_periodic(&tp, arg.task, 1000000, 1000));
+
+    // the tasks which aren't due are freed, counting their group down
+    tp_destroy(&tp);
+
+    assert(0 == tp_group_pending(&group));
+
+    fprintf(stderr, "test_destroy() succeed\n");
+}
+
+
+int main()
+{
+    test_order();
+    test_many();
+    test_periodic();
+    test_destroy();
+
+    return 0;
+}
@@ -73,9 +73,61 @@ void test_self()
 }
 
 
+void *check_pool(void *args)
+{
+    thread_pool_t *tp = *(thread_pool_t **) args;
+    tp_worker_t *worker = tp_self_worker();
+
+    assert(tp_self() == tp);
+    assert(worker != NULL);
+    assert(worker->pool == tp);
+    assert(worker->index < tp->nthread);
+    assert(&tp->workers[worker->index] == worker);
+
+    return NULL;
+}
+
+
+void test_pools()
+{
+    thread_pool_t tp1, tp2;
+    thread_pool_t *p;
+    int i;
+
+    fprintf(stderr, "test_pools() started\n");
+
+    assert(tp_self_worker() == NULL);
+
+    assert(tp_init(&tp1, 3));
+    assert(tp_self() == &tp1);
+    assert(tp_init(&tp2, 2));
+    assert(tp_self() == &tp2);
+    assert(tp_start(&tp1));
+    assert(tp_start(&tp2));
+
+    for (i = 0; i < 1000; ++i) {
+        p = &tp1;
+        assert(tp_post_task(p, tp_task_create(check_pool, NULL, &p, sizeof(p))));
+        p = &tp2;
+        assert(tp_post_task(p, tp_task_create(check_pool, NULL, &p, sizeof(p))));
+    }
+
+    tp_join_tasks(&tp1);
+    tp_join_tasks(&tp2);
+
+    tp_destroy(&tp1);
+    assert(tp_self() == &tp2);
+    tp_destroy(&tp2);
+    assert(tp_self() == NULL);
+
+    fprintf(stderr, "test_pools() succeed\n");
+}
+
+
 int main()
 {
     test_self();
+    test_pools();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread_pool.h"
+
+
+#define THREAD_NUM 4
+#define TASK_NUM 100
+
+
+void *task1(void *args)
+{
+    UNUSED_PARAM(args);
+
+    usleep(100);
+
+    return NULL;
+}
+
+
+/**
+ * Dump the trace and count the occurrences of `pattern` in it.
+ */
+int dump_count(thread_pool_t *tp, const char *pattern)
+{
+    int count = 0;
+    long size;
+    char *buf;
+    char *p;
+    FILE *fp = tmpfile();
+
+    assert(fp);
+    assert(tp_trace_dump(tp, fp));
+
+    size = ftell(fp);
+    buf = malloc((size_t) size + 1);
+    rewind(fp);
+    assert(fread(buf, 1, (size_t) size, fp) == (size_t) size);
+    buf[size] = '\0';
+    fclose(fp);
+
+    assert(strncmp(buf, "{\"displayTimeUnit\"", 18) == 0);
+    assert(strcmp(buf + size - 4, "\n]}\n") == 0);
+
+    for (p = strstr(buf, pattern); p; p = strstr(p + 1, pattern)) {
+        ++count;
+    }
+
+    free(buf);
+
+    return count;
+}
+
+
+void test_events()
+{
+    int i;
+    thread_pool_t tp;
+
+    fprintf(stderr, "test_events() started\n");
+
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+    assert(tp_trace_start(&tp));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(task1, NULL, NULL, 0)));
+    }
+
+    tp_join_tasks(&tp);
+    tp_trace_stop(&tp);
+
+    // nothing is recorded once it's stopped
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(task1, NULL, NULL, 0)));
+    }
+
+    tp_join_tasks(&tp);
+
+    assert(TASK_NUM == dump_count(&tp, "\"name\": \"post\""));
+    assert(TASK_NUM == dump_count(&tp, "\"name\": \"run\", \"cat\": \"task\", \"ph\": \"B\""));
+    assert(TASK_NUM == dump_count(&tp, "\"name\": \"run\", \"cat\": \"task\", \"ph\": \"E\""));
+    assert(TASK_NUM == dump_count(&tp, "\"ph\": \"s\""));
+    assert(TASK_NUM == dump_count(&tp, "\"ph\": \"f\""));
+    assert(dump_count(&tp, "\"name\": \"park\", \"cat\": \"worker\", \"ph\": \"B\"") > 0);
+    assert(dump_count(&tp, "\"name\": \"worker ") >= 1);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_events() succeed\n");
+}
+
+
+void test_overwrite()
+{
+    int i;
+    thread_pool_t tp;
+    tp_attr_t attr;
+
+    fprintf(stderr, "test_overwrite() started\n");
+
+    tp_attr_init(&attr);
+    attr.trace_events = 16;
+
+    assert(tp_init_attr(&tp, 1, &attr));
+    assert(tp_start(&tp));
+    assert(tp_trace_start(&tp));
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(task1, NULL, NULL, 0)));
+    }
+
+    // while the worker is still recording
+    assert(dump_count(&tp, "\"name\": \"post\"") <= 16);
+
+    tp_join_tasks(&tp);
+
+    // only the last events of each thread are kept, but the oldest
+    // slot which the owner may be overwriting
+    assert(15 == dump_count(&tp, "\"name\": \"post\""));
+    assert(dump_count(&tp, "\"ph\": \"B\"") + dump_count(&tp, "\"ph\": \"E\"") <= 16);
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_overwrite() succeed\n");
+}
+
+
+void test_held()
+{
+    int i;
+    thread_pool_t tp;
+    tp_task_t *first;
+    tp_task_t *tasks[TASK_NUM];
+
+    fprintf(stderr, "test_held() started\n");
+
+    assert(tp_init(&tp, THREAD_NUM));
+    assert(tp_start(&tp));
+    assert(tp_trace_start(&tp));
+
+    // all but the first are held when they're posted
+    first = tp_task_create(task1, NULL, NULL, 0);
+
+    for (i = 0; i < TASK_NUM; ++i) {
+        tasks[i] = tp_task_create(task1, NULL, NULL, 0);
+        assert(tp_task_then(first, tasks[i]));
+        assert(tp_post_task(&tp, tasks[i]));
+    }
+
+    assert(tp_post_task(&tp, first));
+    tp_join_tasks(&tp);
+
+    // every run has its post
+    assert(TASK_NUM + 1 == dump_count(&tp, "\"name\": \"post\""));
+    assert(TASK_NUM + 1 == dump_count(&tp, "\"name\": \"run\", \"cat\": \"task\", \"ph\": \"B\""));
+    assert(TASK_NUM + 1 == dump_count(&tp, "\"ph\": \"s\""));
+    assert(TASK_NUM + 1 == dump_count(&tp, "\"ph\": \"f\""));
+
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_held() succeed\n");
+}
+
+
+void test_caller_runs()
+{
+    int i;
+    int nposted = 0;
+    unsigned long long id;
+    unsigned long long posted[16];
+    long size;
+    char *buf;
+    char *p;
+    char *s;
+    char *f;
+    thread_pool_t tp;
+    tp_attr_t attr;
+    FILE *fp = tmpfile();
+
+    fprintf(stderr, "test_caller_runs() started\n");
+
+    // not started, all but the first one run on this thread
+    tp_attr_init(&attr);
+    attr.max_queued = 1;
+    attr.overflow = TP_OVERFLOW_CALLER_RUNS;
+
+    assert(tp_init_attr(&tp, 1, &attr));
+    assert(tp_trace_start(&tp));
+
+    for (i = 0; i < 10; ++i) {
+        assert(tp_post_task(&tp, tp_task_create(task1, NULL, NULL, 0)));
+    }
+
+    assert(fp);
+    assert(tp_trace_dump(&tp, fp));
+
+    size = ftell(fp);
+    buf = malloc((size_t) size + 1);
+    rewind(fp);
+    assert(fread(buf, 1, (size_t) size, fp) == (size_t) size);
+    buf[size] = '\0';
+    fclose(fp);
+
+    // the events of one thread are in order, every run follows the
+    // post of the same task, even though the run frees the task
+    for (p = buf; ; ) {
+        s = strstr(p, "\"ph\": \"s\", \"id\": ");
+        f = strstr(p, "\"ph\": \"f\", \"bp\": \"e\", \"id\": ");
+
+        if (s && (f == NULL || s < f)) {
+            assert(nposted < 16);
+            posted[nposted++] = strtoull(s + 18, NULL, 16);
+            p = s + 1;
+        } else if (f) {
+            id = strtoull(f + 29, NULL, 16);
+
+            for (i = 0; i < nposted && posted[i] != id; ++i) {
+            }
+
+            assert(i < nposted);
+            posted[i] = posted[--nposted];
+            p = f + 1;
+        } else {
+            break;
+        }
+    }
+
+    // the queued one never ran
+    assert(1 == nposted);
+
+    free(buf);
+    tp_destroy(&tp);
+
+    fprintf(stderr, "test_caller_runs() succeed\n");
+}
+
+
+int main()
+{
+#ifdef TP_TRACE
+    test_events();
+    test_overwrite();
+    test_held();
+    test_caller_runs();
+#else
+    thread_pool_t tp;
+
+    // compiled out, nothing can be dumped
+    assert(tp_init(&tp, 1));
+    assert(!tp_trace_start(&tp));
+    assert(!tp_trace_dump(&tp, stderr));
+    tp_destroy(&tp);
+
+    fprintf(stderr, "tracing is compiled out\n");
+#endif
+
+    return 0;
+}